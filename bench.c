@@ -0,0 +1,532 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <time.h>
+#include <sys/resource.h>
+#endif
+
+#include "huffman.h"
+
+/* sizes benchmarked when none are given */
+static const char* default_sizes = "1K,64K,1M,16M";
+
+/* largest corpus the generator accepts */
+#define BENCH_MAX_SIZE ((size_t)1 << 30)
+
+typedef void (*bench_generator)(hc_byte*, size_t, hc_ullong*);
+
+typedef struct bench_corpus {
+	const char* name;
+	bench_generator generate;
+} bench_corpus;
+
+typedef struct bench_result {
+	const char* corpus;
+	size_t size;
+	const char* phase;
+	double seconds;    /* best of the repeats */
+	size_t coded_size;
+	long peak_rss;     /* in KiB, -1 if unknown */
+	int phase_rss;     /* the peak was reset before the phase, rather */
+	                   /* than covering the whole process so far      */
+} bench_result;
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: hcbench [-f csv|json] [-s sizes] [-c corpora] "
+		"[-r repeats] [-T threads] [-S] [-l label]\n");
+	fprintf(stderr, "sizes are comma separated with an optional K, M or G "
+		"suffix (default %s)\n", default_sizes);
+	fprintf(stderr, "corpora: uniform,zipf,text,single,all256 (default all)\n");
+}
+
+/* splitmix64, so every run sees the same corpora */
+static hc_ullong bench_random(hc_ullong* state)
+{
+	hc_ullong z = (*state += 0x9E3779B97F4A7C15ULL);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+	return z ^ (z >> 31);
+}
+
+static void bench_uniform(hc_byte* buf, size_t size, hc_ullong* state)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		buf[i] = (hc_byte)(bench_random(state) >> 56);
+}
+
+/* draws from a Zipf distribution given its cumulative weights */
+static unsigned int bench_zipf_draw(const double* cdf, unsigned int n,
+	hc_ullong* state)
+{
+	double u = (double)(bench_random(state) >> 11) / 9007199254740992.0;
+	unsigned int lo = 0;
+	unsigned int hi = n - 1;
+
+	while (lo < hi)
+	{
+		unsigned int mid = (lo + hi) / 2;
+
+		if (cdf[mid] < u)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static void bench_zipf_cdf(double* cdf, unsigned int n, double s)
+{
+	double total = 0;
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+	{
+		total += 1.0 / pow(i + 1, s);
+		cdf[i] = total;
+	}
+	for (i = 0; i < n; i++)
+		cdf[i] /= total;
+}
+
+static void bench_skewed(hc_byte* buf, size_t size, hc_ullong* state)
+{
+	double cdf[UCHAR_MAX + 1];
+	size_t i;
+
+	bench_zipf_cdf(cdf, UCHAR_MAX + 1, 1.0);
+
+	for (i = 0; i < size; i++)
+		buf[i] = (hc_byte)bench_zipf_draw(cdf, UCHAR_MAX + 1, state);
+}
+
+/* words of a made up vocabulary, picked with Zipf frequencies */
+static void bench_text(hc_byte* buf, size_t size, hc_ullong* state)
+{
+	static const char* letters = "etaoinshrdlcumwfgypbvkjxqz";
+	char words[1024][12];
+	double cdf[1024];
+	size_t pos = 0;
+	unsigned int since_line = 0;
+	unsigned int i;
+	unsigned int j;
+
+	/* short words are more common, as are early letters */
+	for (i = 0; i < 1024; i++)
+	{
+		unsigned int len = 1 + (unsigned int)(bench_random(state) % (2 + i / 64 % 9));
+
+		for (j = 0; j < len; j++)
+			words[i][j] = letters[bench_random(state) % (6 + j * 4 % 20)];
+		words[i][len] = '\0';
+	}
+
+	bench_zipf_cdf(cdf, 1024, 1.1);
+
+	while (pos < size)
+	{
+		const char* word = words[bench_zipf_draw(cdf, 1024, state)];
+		hc_ullong r = bench_random(state) % 100;
+
+		for (j = 0; word[j] != '\0' && pos < size; j++)
+			buf[pos++] = (hc_byte)word[j];
+
+		if (pos == size)
+			break;
+
+		since_line++;
+		if (r < 6)
+			buf[pos++] = '.';
+		else if (r < 12)
+			buf[pos++] = ',';
+
+		if (pos < size)
+		{
+			buf[pos++] = since_line > 12 && r < 20 ? '\n' : ' ';
+			if (buf[pos - 1] == '\n')
+				since_line = 0;
+		}
+	}
+}
+
+static void bench_single(hc_byte* buf, size_t size, hc_ullong* state)
+{
+	(void)state;
+	memset(buf, 'a', size);
+}
+
+static void bench_all256(hc_byte* buf, size_t size, hc_ullong* state)
+{
+	size_t i;
+
+	(void)state;
+	for (i = 0; i < size; i++)
+		buf[i] = (hc_byte)i;
+}
+
+static const bench_corpus corpora[] = {
+	{ "uniform", bench_uniform },
+	{ "zipf", bench_skewed },
+	{ "text", bench_text },
+	{ "single", bench_single },
+	{ "all256", bench_all256 }
+};
+
+#define BENCH_CORPORA (sizeof(corpora) / sizeof(corpora[0]))
+
+/* seconds from a monotonic clock */
+static double bench_now(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+
+	return (double)now.QuadPart / (double)freq.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+
+/* reads a size in KiB from /proc/self/status, or -1 */
+static long bench_status_kb(const char* key)
+{
+	long kb = -1;
+#ifdef __linux__
+	FILE* f = fopen("/proc/self/status", "r");
+	char line[256];
+	size_t n = strlen(key);
+
+	if (f != NULL)
+	{
+		while (fgets(line, sizeof(line), f) != NULL)
+		{
+			if (!strncmp(line, key, n) && line[n] == ':')
+			{
+				kb = strtol(line + n + 1, NULL, 10);
+				break;
+			}
+		}
+		fclose(f);
+	}
+#else
+	(void)key;
+#endif
+
+	return kb;
+}
+
+/*
+ * Starts a new peak RSS measurement. Linux can reset the peak through
+ * /proc, but not every kernel or sandbox allows it, so the reset only
+ * counts if the peak has come down to the current size. Returns 1 if
+ * it did, 0 if the peak still covers the whole process so far.
+ */
+static int bench_reset_rss(void)
+{
+#ifdef __linux__
+	FILE* f = fopen("/proc/self/clear_refs", "w");
+	long hwm;
+	long rss;
+
+	if (f == NULL)
+		return 0;
+
+	/* the write happens on fclose, which reports whether it failed */
+	if (fputs("5", f) == EOF || fclose(f) != 0)
+		return 0;
+
+	hwm = bench_status_kb("VmHWM");
+	rss = bench_status_kb("VmRSS");
+
+	return hwm >= 0 && rss >= 0 && hwm <= rss;
+#else
+	return 0;
+#endif
+}
+
+/* peak resident set size in KiB, or -1 if unknown */
+static long bench_peak_rss(void)
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		return (long)(pmc.PeakWorkingSetSize / 1024);
+
+	return -1;
+#else
+	struct rusage usage;
+	long kb = bench_status_kb("VmHWM");
+
+	if (kb >= 0)
+		return kb;
+
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return -1;
+
+#ifdef __APPLE__
+	return usage.ru_maxrss / 1024;
+#else
+	return usage.ru_maxrss;
+#endif
+#endif
+}
+
+/* parses a size such as 64K, returning 0 if it is not one */
+static size_t bench_parse_size(const char* s, const char** end)
+{
+	char* e;
+	size_t size = (size_t)strtoull(s, &e, 10);
+
+	if (e == s)
+		return 0;
+
+	if (*e == 'K' || *e == 'k')
+		size <<= 10, e++;
+	else if (*e == 'M' || *e == 'm')
+		size <<= 20, e++;
+	else if (*e == 'G' || *e == 'g')
+		size <<= 30, e++;
+
+	*end = e;
+
+	return size;
+}
+
+/* prints a string as a JSON string, quotes included */
+static void bench_print_json(const char* s)
+{
+	putchar('"');
+	for (; *s != '\0'; s++)
+	{
+		unsigned char c = (unsigned char)*s;
+
+		if (c == '"' || c == '\\')
+			printf("\\%c", c);
+		else if (c < 0x20)
+			printf("\\u%04x", c);
+		else
+			putchar(c);
+	}
+	putchar('"');
+}
+
+/* prints a CSV field, quoted if it holds a separator or quote */
+static void bench_print_csv(const char* s)
+{
+	if (strpbrk(s, ",\"\r\n") == NULL)
+	{
+		fputs(s, stdout);
+		return;
+	}
+
+	putchar('"');
+	for (; *s != '\0'; s++)
+	{
+		if (*s == '"')
+			putchar('"');
+		putchar(*s);
+	}
+	putchar('"');
+}
+
+static void bench_print(const bench_result* r, const char* format,
+	const char* label, const hc_options* opts, int first)
+{
+	double mb_s = r->seconds > 0 ? r->size / r->seconds / 1e6 : 0;
+	double ns_byte = r->size > 0 ? r->seconds * 1e9 / r->size : 0;
+	double ratio = r->size > 0 ? (double)r->coded_size / r->size : 0;
+
+	if (!strcmp(format, "json"))
+	{
+		printf("%s\n  {\"label\": ", first ? "" : ",");
+		bench_print_json(label);
+		printf(", \"corpus\": \"%s\", \"size\": %lu, "
+			"\"phase\": \"%s\", \"threads\": %u, \"streams\": %u, "
+			"\"mb_s\": %.2f, \"ns_byte\": %.3f, \"ratio\": %.4f, "
+			"\"peak_rss_kb\": %ld, \"rss_scope\": \"%s\"}",
+			r->corpus, (unsigned long)r->size,
+			r->phase, opts->threads, opts->streams, mb_s, ns_byte, ratio,
+			r->peak_rss, r->phase_rss ? "phase" : "process");
+	}
+	else
+	{
+		bench_print_csv(label);
+		printf(",%s,%lu,%s,%u,%u,%.2f,%.3f,%.4f,%ld,%s\n", r->corpus,
+			(unsigned long)r->size, r->phase, opts->threads, opts->streams,
+			mb_s, ns_byte, ratio, r->peak_rss,
+			r->phase_rss ? "phase" : "process");
+	}
+
+	fflush(stdout);
+}
+
+/* runs encode and decode of one corpus, best of several repeats */
+static int bench_run(const bench_corpus* corpus, size_t size, int repeats,
+	const hc_options* opts, bench_result* enc, bench_result* dec)
+{
+	hc_ullong state = 0x48434F4445ULL ^ size;
+	size_t bound = hc_compress_bound(size);
+	hc_byte* in = (hc_byte*)malloc(size > 0 ? size : 1);
+	hc_byte* coded = (hc_byte*)malloc(bound);
+	hc_byte* out = (hc_byte*)malloc(size > 0 ? size : 1);
+	size_t coded_size = HC_BUFFER_ERROR;
+	size_t out_size = HC_BUFFER_ERROR;
+	double start;
+	double t;
+	int ok;
+	int i;
+
+	corpus->generate(in, size, &state);
+
+	/* touch the buffers so page faults stay out of the timings */
+	memset(coded, 0, bound);
+	memset(out, 0, size);
+
+	enc->corpus = dec->corpus = corpus->name;
+	enc->size = dec->size = size;
+	enc->phase = "encode";
+	dec->phase = "decode";
+	enc->seconds = dec->seconds = -1;
+
+	enc->phase_rss = bench_reset_rss();
+	for (i = 0; i < repeats; i++)
+	{
+		start = bench_now();
+		coded_size = hc_encode_buffer_ex(in, size, coded, bound, opts);
+		t = bench_now() - start;
+		if (enc->seconds < 0 || t < enc->seconds)
+			enc->seconds = t;
+	}
+	enc->peak_rss = bench_peak_rss();
+
+	dec->phase_rss = bench_reset_rss();
+	for (i = 0; i < repeats && coded_size != HC_BUFFER_ERROR; i++)
+	{
+		start = bench_now();
+		out_size = hc_decode_buffer_ex(coded, coded_size, out, size, opts);
+		t = bench_now() - start;
+		if (dec->seconds < 0 || t < dec->seconds)
+			dec->seconds = t;
+	}
+	dec->peak_rss = bench_peak_rss();
+
+	enc->coded_size = dec->coded_size = coded_size;
+
+	ok = coded_size != HC_BUFFER_ERROR && out_size == size
+		&& memcmp(in, out, size) == 0;
+
+	free(in);
+	free(coded);
+	free(out);
+
+	return ok;
+}
+
+int main(int argc, char** argv)
+{
+	const char* format = "csv";
+	const char* sizes = default_sizes;
+	const char* names = NULL;
+	const char* label = "";
+	const char* p;
+	hc_options opts;
+	int repeats = 3;
+	int first = 1;
+	int ok = 1;
+	int i;
+
+	hc_init_options(&opts);
+
+	for (i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-f") && i + 1 < argc)
+			format = argv[++i];
+		else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+			sizes = argv[++i];
+		else if (!strcmp(argv[i], "-c") && i + 1 < argc)
+			names = argv[++i];
+		else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+			repeats = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-T") && i + 1 < argc)
+			opts.threads = (unsigned int)strtoul(argv[++i], NULL, 10);
+		else if (!strcmp(argv[i], "-S"))
+			opts.streams = HC_STREAMS;
+		else if (!strcmp(argv[i], "-l") && i + 1 < argc)
+			label = argv[++i];
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+
+	if ((strcmp(format, "csv") && strcmp(format, "json")) || repeats < 1)
+	{
+		usage();
+		return 1;
+	}
+
+	if (!strcmp(format, "json"))
+		printf("[");
+	else
+		printf("label,corpus,size,phase,threads,streams,mb_s,ns_byte,ratio,"
+			"peak_rss_kb,rss_scope\n");
+
+	for (p = sizes; *p != '\0'; )
+	{
+		size_t size = bench_parse_size(p, &p);
+		size_t c;
+
+		if (size == 0 || size > BENCH_MAX_SIZE || (*p != ',' && *p != '\0'))
+		{
+			fprintf(stderr, "bad size list %s\n", sizes);
+			return 1;
+		}
+		if (*p == ',')
+			p++;
+
+		for (c = 0; c < BENCH_CORPORA; c++)
+		{
+			bench_result enc;
+			bench_result dec;
+
+			if (names != NULL && strstr(names, corpora[c].name) == NULL)
+				continue;
+
+			if (!bench_run(&corpora[c], size, repeats, &opts, &enc, &dec))
+			{
+				fprintf(stderr, "%s %lu did not round trip\n",
+					corpora[c].name, (unsigned long)size);
+				ok = 0;
+			}
+
+			bench_print(&enc, format, label, &opts, first);
+			bench_print(&dec, format, label, &opts, 0);
+			first = 0;
+		}
+	}
+
+	if (!strcmp(format, "json"))
+		printf("\n]\n");
+
+	return ok ? 0 : 1;
+}
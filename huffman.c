@@ -1,10 +1,167 @@
 #include "huffman.h"
 
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#include <io.h>
+typedef HANDLE hc_thread;
+#else
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <time.h>
+typedef pthread_t hc_thread;
+#endif
+
+/*
+ * Heap allocations made by the library, counted only while a call is
+ * collecting stats so that the count costs nothing otherwise.
+ */
+static volatile long hc_alloc_tracking = 0;
+static volatile hc_ullong hc_alloc_count = 0;
+
+#ifdef _WIN32
+#define hc_atomic_add(p, v) InterlockedExchangeAdd64((volatile LONG64*)(p), (v))
+#define hc_atomic_add_long(p, v) InterlockedExchangeAdd((volatile LONG*)(p), (v))
+#else
+#define hc_atomic_add(p, v) __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#define hc_atomic_add_long(p, v) __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#endif
+
+static void hc_count_alloc(void)
+{
+	if (hc_alloc_tracking > 0)
+		hc_atomic_add(&hc_alloc_count, 1);
+}
+
+static void* hc_malloc(size_t size)
+{
+	hc_count_alloc();
+	return malloc(size);
+}
+
+static void* hc_calloc(size_t count, size_t size)
+{
+	hc_count_alloc();
+	return calloc(count, size);
+}
+
+static void* hc_realloc(void* p, size_t size)
+{
+	hc_count_alloc();
+	return realloc(p, size);
+}
+
+/* seconds from a monotonic clock */
+static double hc_now(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+
+	return (double)now.QuadPart / (double)freq.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+
+/* starts collecting stats for a call */
+static void hc_begin_stats(hc_stats* stats)
+{
+	memset(stats, 0, sizeof(hc_stats));
+	hc_atomic_add_long(&hc_alloc_tracking, 1);
+
+	/* hold the starting points until the call ends */
+	stats->allocations = hc_atomic_add(&hc_alloc_count, 0);
+	stats->total_time = hc_now();
+}
+
+/* finishes the stats of a call, whose byte counts are already set */
+static void hc_end_stats(hc_stats* stats)
+{
+	stats->total_time = hc_now() - stats->total_time;
+	stats->allocations = hc_atomic_add(&hc_alloc_count, 0)
+		- stats->allocations;
+	hc_atomic_add_long(&hc_alloc_tracking, -1);
+}
+
+/* adds the phases and counters of a worker to those of its call */
+static void hc_add_stats(hc_stats* stats, const hc_stats* part)
+{
+	stats->read_time += part->read_time;
+	stats->histogram_time += part->histogram_time;
+	stats->tree_time += part->tree_time;
+	stats->table_time += part->table_time;
+	stats->code_time += part->code_time;
+	stats->write_time += part->write_time;
+	stats->blocks += part->blocks;
+	stats->header_bytes += part->header_bytes;
+	stats->code_bits += part->code_bits;
+	stats->symbols += part->symbols;
+	if (part->unique > stats->unique)
+		stats->unique = part->unique;
+	if (part->max_code_len > stats->max_code_len)
+		stats->max_code_len = part->max_code_len;
+}
+
+/*
+ * Times the phases of a block one after another. Time spent reading
+ * or writing meanwhile is already counted and left out of the phases.
+ */
+typedef struct hc_timer {
+	hc_stats* stats;
+	double start;
+	double io_time;
+} hc_timer;
+
+static void hc_start_timer(hc_timer* timer, hc_stats* stats)
+{
+	timer->stats = stats;
+	timer->start = hc_now();
+	timer->io_time = stats->read_time + stats->write_time;
+}
+
+/* adds the time since the last lap to a phase */
+static void hc_lap(hc_timer* timer, double* phase)
+{
+	double now = hc_now();
+	double io_time = timer->stats->read_time + timer->stats->write_time;
+
+	*phase += now - timer->start - (io_time - timer->io_time);
+	timer->start = now;
+	timer->io_time = io_time;
+}
+
+/* counts the codes of a table */
+static void hc_table_stats(hc_stats* stats, const hc_sym* dict, hc_ulong len)
+{
+	hc_ulong i;
+
+	if (len > stats->unique)
+		stats->unique = len;
+
+	for (i = 0; i < len; i++)
+	{
+		if (dict[i].code->bit_count > stats->max_code_len)
+			stats->max_code_len = dict[i].code->bit_count;
+	}
+}
 
 hc_node* hc_create_node()
 {
-	hc_node* node = (hc_node*)malloc(sizeof(hc_node));
+	hc_node* node = (hc_node*)hc_malloc(sizeof(hc_node));
 	node->leaf_1 = NULL;
 	node->leaf_2 = NULL;
 	node->next = NULL;
@@ -20,10 +177,12 @@ hc_node* hc_create_node()
 
 hc_node_list* hc_create_list()
 {
-	hc_node_list* list = (hc_node_list*)malloc(sizeof(hc_node_list));
+	hc_node_list* list = (hc_node_list*)hc_malloc(sizeof(hc_node_list));
 
 	list->count = 0;
 	list->nodes = NULL;
+	list->tail = NULL;
+	list->arena = NULL;
 
 	return list;
 }
@@ -49,7 +208,7 @@ void hc_destroy_node(hc_node* node)
 
 void hc_destroy_list(hc_node_list* list)
 {
-	if (list == NULL)
+	if (list == NULL || list->arena != NULL)
 		return;
 
 	hc_node* node = list->nodes;
@@ -63,6 +222,70 @@ void hc_destroy_list(hc_node_list* list)
 	free(list);
 }
 
+hc_arena* hc_create_arena()
+{
+	hc_arena* arena = (hc_arena*)hc_malloc(sizeof(hc_arena));
+
+	hc_reset_arena(arena);
+
+	return arena;
+}
+
+void hc_reset_arena(hc_arena* arena)
+{
+	arena->node_count = 0;
+	arena->code_count = 0;
+	arena->list.count = 0;
+	arena->list.nodes = NULL;
+	arena->list.tail = NULL;
+	arena->list.arena = arena;
+}
+
+void hc_destroy_arena(hc_arena* arena)
+{
+	free(arena);
+}
+
+hc_node_list* hc_arena_list(hc_arena* arena)
+{
+	return &(arena->list);
+}
+
+hc_node* hc_arena_node(hc_arena* arena)
+{
+	if (arena->node_count == HC_ARENA_NODES)
+		return NULL;
+
+	hc_node* node = &(arena->nodes[arena->node_count++]);
+	node->leaf_1 = NULL;
+	node->leaf_2 = NULL;
+	node->next = NULL;
+	node->prev = NULL;
+	node->sym.code = NULL;
+	node->sym.b = 0;
+	node->sym.f = 0;
+	node->sym.w = 0;
+	node->sym.n = 0;
+
+	return node;
+}
+
+hc_bitstring* hc_arena_bitstring(hc_arena* arena)
+{
+	if (arena->code_count == UCHAR_MAX + 1)
+		return NULL;
+
+	hc_bitstring* bs = &(arena->codes[arena->code_count]);
+	bs->bytes = arena->code_bytes[arena->code_count++];
+	bs->bytes[0] = 0;
+	bs->bit_count = 0;
+	bs->byte_count = 1;
+	bs->current_bits = 0;
+	bs->fixed = 1;
+
+	return bs;
+}
+
 void hc_add_node(hc_node_list* list, hc_node* node)
 {
 	if (list->count == 0 && list->nodes == NULL)
@@ -82,127 +305,255 @@ void hc_add_node(hc_node_list* list, hc_node* node)
 	list->count++;
 }
 
-void hc_sort_leaves(hc_node_list* list)
+/* links the nodes of an array into a list in array order */
+static void hc_link_nodes(hc_node_list* list, hc_node** nodes, hc_ulong count)
 {
-	int sorted = 0;
-	while (!sorted)
-	{
-		sorted = 1;
-		hc_node** node = &(list->nodes);
-		while (*node != NULL)
-		{
-			if ((*node)->next != NULL && (*node)->next->sym.f < (*node)->sym.f)
-			{
-				sorted = 0;
-				hc_node* next = (*node)->next;
+	hc_ulong i;
 
-				(*node)->next = next->next;
-				next->prev = (*node)->prev;
-				if (next->next != NULL)
-				{
-					next->next->prev = *node;
-				}
-				(*node)->prev = next;
-				next->next = *node;
-				*node = next;
-			}
-			else
-			{
-				node = &((*node)->next);
-			}
-		}
+	for (i = 0; i < count; i++)
+	{
+		nodes[i]->prev = i > 0 ? nodes[i - 1] : NULL;
+		nodes[i]->next = i + 1 < count ? nodes[i + 1] : NULL;
 	}
+
+	list->nodes = count > 0 ? nodes[0] : NULL;
+	list->tail = count > 0 ? nodes[count - 1] : NULL;
+	list->count = count;
 }
 
-void hc_construct_tree(hc_node_list* list)
+void hc_sort_leaves(hc_node_list* list)
 {
-	int built = 0;
-	while (!built)
+	hc_node* buf[2][UCHAR_MAX + 1];
+	hc_node** from = buf[0];
+	hc_node** to = buf[1];
+	hc_node** heap = NULL;
+	hc_node* node;
+	hc_ulong count = 0;
+	hc_ulong max_f = 0;
+	hc_ulong i;
+	unsigned int shift;
+
+	for (node = list->nodes; node != NULL; node = node->next)
+		count++;
+
+	/* a byte alphabet fits on the stack, longer lists go on the heap */
+	if (count > UCHAR_MAX + 1)
+	{
+		heap = (hc_node**)hc_malloc(2 * count * sizeof(hc_node*));
+		if (heap == NULL)
+			return;
+		from = heap;
+		to = heap + count;
+	}
+
+	for (node = list->nodes, count = 0; node != NULL; node = node->next)
+	{
+		from[count++] = node;
+		if (node->sym.f > max_f)
+			max_f = node->sym.f;
+	}
+
+	/*
+	 * Radix sort on the frequencies, one byte per pass from the lowest,
+	 * stopping after the highest byte that is set in any of them. Each
+	 * pass keeps the order of equal keys, so equal frequencies stay in
+	 * list order.
+	 */
+	for (shift = 0; shift < sizeof(hc_ulong) * CHAR_BIT
+		&& (max_f >> shift) > 0; shift += CHAR_BIT)
 	{
-		built = 1;
+		hc_ulong pos[UCHAR_MAX + 1] = { 0 };
+		hc_ulong sum = 0;
+		hc_node** tmp;
 
-		hc_node** node = &(list->nodes);
+		for (i = 0; i < count; i++)
+			pos[(from[i]->sym.f >> shift) & UCHAR_MAX]++;
 
-		if ((*node)->next != NULL)
+		for (i = 0; i < UCHAR_MAX + 1; i++)
 		{
-			built = 0;
+			hc_ulong n = pos[i];
+			pos[i] = sum;
+			sum += n;
+		}
 
-			hc_node* sum = (hc_node*)malloc(sizeof(hc_node));
-			sum->next = NULL;
-			sum->prev = NULL;
-			sum->sym.f = (*node)->sym.f + (*node)->next->sym.f;
-			sum->sym.b = 0;
-			sum->sym.w = 1;
-			sum->sym.n = 1;
-			sum->sym.code = NULL;
-			sum->leaf_1 = *node;
-			sum->leaf_2 = (*node)->next;
+		for (i = 0; i < count; i++)
+			to[pos[(from[i]->sym.f >> shift) & UCHAR_MAX]++] = from[i];
 
-			hc_node* next = (*node)->next->next;
-			hc_node* last_next = next;
-			hc_node* new_head = next;
+		tmp = from;
+		from = to;
+		to = tmp;
+	}
 
-			while (next != NULL && next->sym.f < sum->sym.f)
-			{
-				last_next = next;
-				next = next->next;
-			}
+	hc_link_nodes(list, from, count);
+	free(heap);
+}
 
-			sum->next = next;
+void hc_construct_tree(hc_node_list* list)
+{
+	hc_node* buf[2 * UCHAR_MAX + 1];
+	hc_node** leaves = buf;
+	hc_node** sums = buf + UCHAR_MAX + 1;
+	hc_node** heap = NULL;
+	hc_ulong leaf_count = 0;
+	hc_ulong leaf_pos = 0;
+	hc_ulong sum_count = 0;
+	hc_ulong sum_pos = 0;
+	hc_node* node;
+
+	for (node = list->nodes; node != NULL; node = node->next)
+		leaf_count++;
+
+	if (leaf_count < 2)
+		return;
 
-			if (next != NULL)
-			{
-				sum->prev = next->prev;
-				if (next->prev != NULL)
-				{
-					next->prev->next = sum;
-				}
-				next->prev = sum;
-			}
-			else if (next == NULL && last_next != NULL)
-			{
-				last_next->next = sum;
-				sum->prev = last_next;
-			}
+	/* n leaves make n - 1 sums, on the heap past a byte alphabet */
+	if (leaf_count > UCHAR_MAX + 1)
+	{
+		heap = (hc_node**)hc_malloc((2 * leaf_count - 1) * sizeof(hc_node*));
+		if (heap == NULL)
+			return;
+		leaves = heap;
+		sums = heap + leaf_count;
+	}
+
+	for (node = list->nodes, leaf_count = 0; node != NULL; node = node->next)
+		leaves[leaf_count++] = node;
+
+	/*
+	 * Two queue construction: the sorted leaves form one queue and
+	 * the merged nodes, which are made in order of weight, the other.
+	 * The two lightest nodes are always at the front of the queues.
+	 * Leaves win ties, which keeps the tree shallow.
+	 */
+	while (leaf_count - leaf_pos + sum_count - sum_pos > 1)
+	{
+		hc_node* pick[2];
+		int k;
 
-			if (new_head == NULL || new_head == next)
+		for (k = 0; k < 2; k++)
+		{
+			if (sum_pos == sum_count || (leaf_pos < leaf_count
+				&& leaves[leaf_pos]->sym.f <= sums[sum_pos]->sym.f))
 			{
-				*node = sum;
+				pick[k] = leaves[leaf_pos++];
 			}
 			else
 			{
-				new_head->prev = NULL;
-				*node = new_head;
+				pick[k] = sums[sum_pos++];
 			}
-
-			list->count--;
+			pick[k]->next = NULL;
+			pick[k]->prev = NULL;
 		}
+
+		hc_node* sum = list->arena != NULL ? hc_arena_node(list->arena)
+			: (hc_node*)hc_malloc(sizeof(hc_node));
+		sum->next = NULL;
+		sum->prev = NULL;
+		sum->sym.f = pick[0]->sym.f + pick[1]->sym.f;
+		sum->sym.b = 0;
+		sum->sym.w = 1;
+		sum->sym.n = 1;
+		sum->sym.code = NULL;
+		sum->leaf_1 = pick[0];
+		sum->leaf_2 = pick[1];
+
+		sums[sum_count++] = sum;
 	}
+
+	hc_link_nodes(list, &sums[sum_count - 1], 1);
+	free(heap);
 }
 
-static void hc_assign_node(hc_node* node, hc_ulong level, hc_bitstring* bs)
+static void hc_assign_node(hc_node* node, hc_ulong level,
+	hc_sym** leaves, hc_ulong* count)
 {
 	if (node == NULL) return;
 
 	if (node->sym.w < 1)
 	{
-		node->sym.n = level;
-		hc_add_bits(node->sym.code, bs);
+		/* a lone leaf at the root still needs a one bit code */
+		node->sym.n = level > 0 ? level : 1;
+		leaves[(*count)++] = &(node->sym);
 	}
 
-	if (node->leaf_1 != NULL)
+	hc_assign_node(node->leaf_1, level + 1, leaves, count);
+	hc_assign_node(node->leaf_2, level + 1, leaves, count);
+}
+
+static void hc_canonical_codes(hc_sym** syms, hc_ulong count)
+{
+	hc_byte buf[UCHAR_MAX + 1];
+	hc_byte* code = buf; /* one bit per byte, first bit first */
+	hc_ulong len = 0;
+	hc_ulong i;
+	hc_ulong j;
+
+	/* codes of trees with more leaves than bytes can outgrow the buffer */
+	for (i = 0; i < count; i++)
 	{
-		hc_add_bit(bs, 1);
-		hc_assign_node(node->leaf_1, level + 1, bs);
-		hc_remove_bit(bs);
+		if (syms[i]->n > len)
+			len = syms[i]->n;
 	}
 
-	if (node->leaf_2 != NULL)
+	if (len > sizeof(buf))
+	{
+		code = (hc_byte*)hc_malloc(len);
+		if (code == NULL)
+			return;
+	}
+	len = 0;
+
+	/* order the symbols by code length, then by byte value */
+	for (i = 1; i < count; i++)
+	{
+		hc_sym* sym = syms[i];
+		for (j = i; j > 0 && (syms[j - 1]->n > sym->n
+			|| (syms[j - 1]->n == sym->n && syms[j - 1]->b > sym->b)); j--)
+		{
+			syms[j] = syms[j - 1];
+		}
+		syms[j] = sym;
+	}
+
+	for (i = 0; i < count; i++)
 	{
-		hc_add_bit(bs, 0);
-		hc_assign_node(node->leaf_2, level + 1, bs);
-		hc_remove_bit(bs);
+		/* each code is the previous one plus one, padded with zeros */
+		if (i > 0)
+		{
+			for (j = len; j > 0 && code[j - 1] == 1; j--)
+				code[j - 1] = 0;
+			if (j > 0)
+				code[j - 1] = 1;
+		}
+		while (len < syms[i]->n)
+			code[len++] = 0;
+
+		hc_bitstring* bs = syms[i]->code;
+		if (!bs->fixed)
+			bs->bytes = (hc_byte*)hc_realloc(bs->bytes, sizeof(hc_byte));
+		bs->bytes[0] = 0;
+		bs->bit_count = 0;
+		bs->byte_count = 1;
+		bs->current_bits = 0;
+
+		for (j = 0; j < len; j++)
+			hc_add_bit(bs, code[j]);
 	}
+
+	if (code != buf)
+		free(code);
+}
+
+/* counts the leaves below a node */
+static hc_ulong hc_count_leaves(const hc_node* node)
+{
+	if (node == NULL)
+		return 0;
+
+	if (node->sym.w < 1)
+		return 1;
+
+	return hc_count_leaves(node->leaf_1) + hc_count_leaves(node->leaf_2);
 }
 
 void hc_assign_codes(hc_node_list* list)
@@ -210,20 +561,141 @@ void hc_assign_codes(hc_node_list* list)
 	if (list == NULL)
 		return;
 
-	hc_node* node = list->nodes;
+	hc_sym* buf[UCHAR_MAX + 1];
+	hc_sym** leaves = buf;
+	hc_ulong count = hc_count_leaves(list->nodes);
 
-	node->sym.n = 0;
+	/* as with hc_sort_leaves, more leaves than bytes go on the heap */
+	if (count > UCHAR_MAX + 1)
+	{
+		leaves = (hc_sym**)hc_malloc(count * sizeof(hc_sym*));
+		if (leaves == NULL)
+			return;
+	}
 
-	hc_bitstring* bs = hc_create_bitstring();
+	count = 0;
+	hc_assign_node(list->nodes, 0, leaves, &count);
+
+	hc_canonical_codes(leaves, count);
+
+	if (leaves != buf)
+		free(leaves);
+}
+
+int hc_limit_code_lengths(hc_sym* table, hc_ulong len, hc_ulong max_len,
+	hc_ullong* extra_bits)
+{
+	hc_sym* syms[UCHAR_MAX + 1];
+	hc_ulong weights[2][2 * (UCHAR_MAX + 1)];
+	hc_byte packed[HC_MAX_CODE_LEN][2 * (UCHAR_MAX + 1)];
+	hc_ulong counts[HC_MAX_CODE_LEN];
+	hc_ullong before = 0;
+	hc_ullong after = 0;
+	hc_ulong longest = 0;
+	hc_ulong prev_count = 0;
+	hc_ulong level;
+	hc_ulong i;
+	hc_ulong j;
+	hc_ulong k;
+
+	if (extra_bits != NULL)
+		*extra_bits = 0;
+
+	if (len > UCHAR_MAX + 1)
+		return 0;
+
+	for (i = 0; i < len; i++)
+	{
+		syms[i] = &table[i];
+		before += (hc_ullong)table[i].f * table[i].n;
+		if (table[i].n > longest)
+			longest = table[i].n;
+	}
+
+	if (longest <= max_len || len < 2)
+		return 1;
+
+	/* len symbols need codes of at least log2(len) bits */
+	if (max_len > HC_MAX_CODE_LEN || ((hc_ulong)1 << max_len) < len)
+		return 0;
+
+	/* order the symbols by frequency, lightest first */
+	for (i = 1; i < len; i++)
+	{
+		hc_sym* sym = syms[i];
+		for (j = i; j > 0 && syms[j - 1]->f > sym->f; j--)
+			syms[j] = syms[j - 1];
+		syms[j] = sym;
+	}
 
-	if (node->sym.w == 0)
+	/*
+	 * Package-merge: at each level from the longest allowed length up,
+	 * the symbols are merged with pairs packaged from the level below,
+	 * lightest first. Only whether an item is a package is kept, which
+	 * is enough to count how often each symbol is chosen afterwards.
+	 */
+	for (level = 0; level < max_len; level++)
+	{
+		hc_ulong* prev = weights[level % 2];
+		hc_ulong* cur = weights[(level + 1) % 2];
+		hc_ulong pairs = prev_count / 2;
+
+		i = 0;
+		j = 0;
+		k = 0;
+		while (i < len || j < pairs)
+		{
+			if (j == pairs || (i < len
+				&& syms[i]->f <= prev[2 * j] + prev[2 * j + 1]))
+			{
+				cur[k] = syms[i++]->f;
+				packed[level][k++] = 0;
+			}
+			else
+			{
+				cur[k] = prev[2 * j] + prev[2 * j + 1];
+				packed[level][k++] = 1;
+				j++;
+			}
+		}
+
+		counts[level] = k;
+		prev_count = k;
+	}
+
+	/*
+	 * The 2n - 2 lightest items of the top level make the code. Each
+	 * symbol gets one bit for every level it is chosen at, and the
+	 * packages chosen at a level choose twice as many items below.
+	 */
+	for (i = 0; i < len; i++)
+		syms[i]->n = 0;
+
+	k = 2 * len - 2;
+	for (level = max_len; level > 0 && k > 0; level--)
 	{
-		hc_add_bit(bs, 0);
+		hc_ulong taken = 0;
+
+		for (i = 0, j = 0; i < k && i < counts[level - 1]; i++)
+		{
+			if (packed[level - 1][i])
+				taken++;
+			else
+				syms[j++]->n++;
+		}
+
+		k = 2 * taken;
 	}
 
-	hc_assign_node(node, 0, bs);
+	for (i = 0; i < len; i++)
+		after += (hc_ullong)table[i].f * table[i].n;
+
+	if (extra_bits != NULL)
+		*extra_bits = after - before;
 
-	hc_destroy_bitstring(bs);
+	hc_canonical_codes(syms, len);
+
+	return 1;
 }
 
 void hc_print_list(hc_node_list* list)
@@ -280,20 +752,21 @@ void hc_print_tree(hc_node_list* list)
 
 hc_bitstring* hc_create_bitstring()
 {
-	hc_bitstring* bs = (hc_bitstring*)malloc(sizeof(hc_bitstring));
+	hc_bitstring* bs = (hc_bitstring*)hc_malloc(sizeof(hc_bitstring));
 
 	bs->bit_count = 0;
 	bs->byte_count = 1;
-	bs->bytes = malloc(sizeof(hc_byte));
+	bs->bytes = hc_malloc(sizeof(hc_byte));
 	bs->bytes[0] = 0;
 	bs->current_bits = 0;
+	bs->fixed = 0;
 
 	return bs;
 }
 
 void hc_destroy_bitstring(hc_bitstring* bs)
 {
-	if (bs == NULL)
+	if (bs == NULL || bs->fixed)
 		return;
 
 	free(bs->bytes);
@@ -307,7 +780,10 @@ void hc_add_bit(hc_bitstring* bs, unsigned int bit)
 
 	if (bs->current_bits == CHAR_BIT)
 	{
-		bs->bytes = (hc_byte*)realloc(bs->bytes, bs->byte_count + 1);
+		if (bs->fixed && bs->byte_count == HC_CODE_BYTES)
+			return;
+		if (!bs->fixed)
+			bs->bytes = (hc_byte*)hc_realloc(bs->bytes, bs->byte_count + 1);
 		bs->byte_count++;
 		bs->current_bits = 0;
 		bs->bytes[bs->byte_count - 1] = 0;
@@ -352,7 +828,8 @@ void hc_remove_bit(hc_bitstring* bs)
 
 	if (bs->current_bits == 0 && bs->byte_count > 1)
 	{
-		bs->bytes = (hc_byte*)realloc(bs->bytes, bs->byte_count - 1);
+		if (!bs->fixed)
+			bs->bytes = (hc_byte*)hc_realloc(bs->bytes, bs->byte_count - 1);
 		bs->byte_count--;
 		bs->current_bits = CHAR_BIT;
 	}
@@ -383,74 +860,549 @@ void hc_print_bitstring(hc_bitstring* bs)
 	}
 }
 
-hc_bitstring* hc_encode_data(FILE* input, hc_sym* table, hc_ulong len)
+hc_reader* hc_create_reader(FILE* stream)
 {
-	hc_bitstring* bs = hc_create_bitstring();
+	hc_reader* r = (hc_reader*)hc_malloc(sizeof(hc_reader));
+
+	r->stream = stream;
+	r->cap = HC_IO_BUFFER;
+	r->buf = (hc_byte*)hc_malloc(r->cap);
+	r->pos = 0;
+	r->len = 0;
+	r->partial = 0;
+	r->offset = 0;
+	r->stats = NULL;
+
+	return r;
+}
 
-	hc_ulong i;
-	hc_byte b;
+hc_reader* hc_create_memory_reader(const void* data, size_t size)
+{
+	hc_reader* r = (hc_reader*)hc_malloc(sizeof(hc_reader));
+
+	r->stream = NULL;
+	r->cap = size;
+	r->buf = (hc_byte*)data;
+	r->pos = 0;
+	r->len = size;
+	r->partial = 0;
+	r->offset = 0;
+	r->stats = NULL;
+
+	return r;
+}
+
+void hc_destroy_reader(hc_reader* r)
+{
+	if (r == NULL)
+		return;
 
-	while (fread(&b, 1, 1, input) == 1)
+	/* memory readers do not own their bytes */
+	if (r->stream == NULL)
 	{
-		for (i = 0; i < len; i++)
-		{
-			if (table[i].b == b)
-				hc_add_bits(bs, table[i].code);
-		}
+		free(r);
+		return;
 	}
 
-	return bs;
-}
+	/* hand bytes that were read ahead back to a seekable stream */
+#ifndef _WIN32
+	if (r->pos < r->len && r->partial)
+		lseek(fileno(r->stream), -(off_t)(r->len - r->pos), SEEK_CUR);
+	else
+#endif
+	if (r->pos < r->len)
+		fseek(r->stream, -(long)(r->len - r->pos), SEEK_CUR);
 
-/* metadata */
-static hc_byte table_begin = 1;
-static hc_byte table_byte = 2;
-static hc_byte table_code = 3;
-static hc_byte table_end = 4;
-static hc_byte data_begin = 5;
-static hc_byte data_end = 6;
+	free(r->buf);
+	free(r);
+}
 
-void hc_write_table(FILE* out_file, hc_sym* table, hc_ulong len)
+/*
+ * Refills the buffer of a reader once everything in it was consumed.
+ * Returns the number of bytes available.
+ */
+static size_t hc_fill_reader(hc_reader* r)
 {
-	hc_ulong i;
-	hc_ulong j;
+	double start;
 
-	fwrite(&table_begin, 1, 1, out_file);
+	if (r->pos < r->len || r->stream == NULL)
+		return r->len - r->pos;
 
-	for (i = 0; i < len; i++)
+	start = r->stats != NULL ? hc_now() : 0;
+	r->offset += r->len;
+	r->pos = 0;
+
+#ifndef _WIN32
+	/* take whatever live input has arrived rather than wait for more */
+	if (r->partial)
 	{
-		/* write the byte */
-		fwrite(&table_byte, sizeof(hc_byte), 1, out_file);
-		fwrite(&(table[i].b), sizeof(hc_byte), 1, out_file);
+		ssize_t n;
 
-		/* write the bit code metadata */
-		fwrite(&table_code, sizeof(hc_byte), 1, out_file);
-		fwrite(&(table[i].code->bit_count), sizeof(hc_ulong), 1, out_file);
-		fwrite(&(table[i].code->byte_count), sizeof(hc_ulong), 1, out_file);
-		fwrite(&(table[i].code->current_bits), sizeof(hc_byte), 1, out_file);
+		do
+			n = read(fileno(r->stream), r->buf, r->cap);
+		while (n < 0 && errno == EINTR);
 
-		/* write the bit code data */
-		for (j = 0; j < table[i].code->byte_count; j++)
-		{
-			fwrite(&(table[i].code->bytes[j]), sizeof(hc_byte), 1, out_file);
-		}
+		r->len = n > 0 ? (size_t)n : 0;
 	}
+	else
+#endif
+	r->len = fread(r->buf, 1, r->cap, r->stream);
+
+	if (r->stats != NULL)
+		r->stats->read_time += hc_now() - start;
 
-	fwrite(&table_end, 1, 1, out_file);
+	return r->len;
 }
 
-hc_sym* hc_read_table(FILE *in_stream, size_t *len)
+/* gives the number of bytes consumed from a reader */
+static hc_ullong hc_reader_tell(const hc_reader* r)
 {
-	size_t cap = 10;
-	size_t count = 0;
-	size_t flag = 1;
+	return r->offset + r->pos;
+}
 
-	hc_sym* table = (hc_sym*)malloc(sizeof(hc_sym) * cap);
+/* reads one byte, returning EOF at the end of the stream */
+static int hc_read_byte(hc_reader* r)
+{
+	if (r->pos == r->len && hc_fill_reader(r) == 0)
+		return EOF;
+
+	return r->buf[r->pos++];
+}
+
+/* returns the next byte without consuming it */
+static int hc_peek_byte(hc_reader* r)
+{
+	if (r->pos == r->len && hc_fill_reader(r) == 0)
+		return EOF;
+
+	return r->buf[r->pos];
+}
+
+/* decodes little endian integers from a buffer */
+static hc_ulong hc_get_u32(const hc_byte* b)
+{
+	return (hc_ulong)b[0] | ((hc_ulong)b[1] << 8)
+		| ((hc_ulong)b[2] << 16) | ((hc_ulong)b[3] << 24);
+}
+
+static hc_ullong hc_get_u64(const hc_byte* b)
+{
+	return (hc_ullong)hc_get_u32(b) | ((hc_ullong)hc_get_u32(b + 4) << 32);
+}
+
+/* reads a 32 bit little endian integer */
+static int hc_read_u32(hc_reader* r, hc_ulong* v)
+{
+	hc_byte b[4];
+
+	if (hc_read(r, b, 4) != 4)
+		return 0;
+
+	*v = hc_get_u32(b);
+
+	return 1;
+}
+
+size_t hc_read(hc_reader* r, void* dest, size_t size)
+{
+	hc_byte* out = (hc_byte*)dest;
+	size_t done = 0;
+
+	while (done < size)
+	{
+		/* large reads skip the buffer once it has been drained */
+		if (r->pos == r->len && size - done >= r->cap && r->stream != NULL
+			&& !r->partial)
+		{
+			double start = r->stats != NULL ? hc_now() : 0;
+			size_t n = fread(out + done, 1, size - done, r->stream);
+
+			if (r->stats != NULL)
+				r->stats->read_time += hc_now() - start;
+
+			r->offset += n;
+			done += n;
+			break;
+		}
+
+		size_t avail = hc_fill_reader(r);
+		if (avail == 0)
+			break;
+
+		size_t n = size - done < avail ? size - done : avail;
+		memcpy(out + done, r->buf + r->pos, n);
+		r->pos += n;
+		done += n;
+	}
+
+	return done;
+}
+
+hc_writer* hc_create_writer(FILE* stream)
+{
+	hc_writer* w = (hc_writer*)hc_malloc(sizeof(hc_writer));
+
+	w->stream = stream;
+	w->cap = HC_IO_BUFFER;
+	w->buf = (hc_byte*)hc_malloc(w->cap);
+	w->len = 0;
+	w->flushed = 0;
+	w->fixed = 0;
+	w->error = 0;
+	w->stats = NULL;
+
+	return w;
+}
+
+hc_writer* hc_create_memory_writer(size_t cap)
+{
+	hc_writer* w = hc_create_writer(NULL);
+
+	if (cap > w->cap)
+	{
+		w->cap = cap;
+		w->buf = (hc_byte*)hc_realloc(w->buf, w->cap);
+	}
+
+	return w;
+}
+
+hc_writer* hc_create_buffer_writer(void* dest, size_t cap)
+{
+	hc_writer* w = (hc_writer*)hc_malloc(sizeof(hc_writer));
+
+	w->stream = NULL;
+	w->cap = cap;
+	w->buf = (hc_byte*)dest;
+	w->len = 0;
+	w->flushed = 0;
+	w->fixed = 1;
+	w->error = 0;
+	w->stats = NULL;
+
+	return w;
+}
+
+void hc_destroy_writer(hc_writer* w)
+{
+	if (w == NULL)
+		return;
+
+	hc_flush_writer(w);
+
+	if (!w->fixed)
+		free(w->buf);
+	free(w);
+}
+
+int hc_flush_writer(hc_writer* w)
+{
+	/* memory writers keep everything in their buffer */
+	if (w->stream == NULL)
+		return !w->error;
+
+	if (w->len > 0)
+	{
+		double start = w->stats != NULL ? hc_now() : 0;
+
+		fwrite(w->buf, 1, w->len, w->stream);
+		w->flushed += w->len;
+		w->len = 0;
+
+		if (w->stats != NULL)
+			w->stats->write_time += hc_now() - start;
+	}
+
+	return !ferror(w->stream);
+}
+
+/*
+ * Makes room for at least size more bytes in the buffer of a writer.
+ * Returns 0 if a fixed buffer is too small, in which case the writer
+ * is marked as failed.
+ */
+static int hc_reserve(hc_writer* w, size_t size)
+{
+	if (w->cap - w->len >= size)
+		return 1;
+
+	if (w->stream != NULL)
+	{
+		hc_flush_writer(w);
+		return 1;
+	}
+
+	if (w->fixed)
+	{
+		w->error = 1;
+		return 0;
+	}
+
+	while (w->cap - w->len < size)
+		w->cap *= 2;
+	w->buf = (hc_byte*)hc_realloc(w->buf, w->cap);
+
+	return 1;
+}
+
+/* writes one byte */
+static void hc_write_byte(hc_writer* w, hc_byte b)
+{
+	if (w->len == w->cap && !hc_reserve(w, 1))
+		return;
+
+	w->buf[w->len++] = b;
+}
+
+/* writes a 32 bit little endian integer */
+static void hc_write_u32(hc_writer* w, hc_ulong v)
+{
+	hc_byte b[4];
+
+	b[0] = (hc_byte)(v & 0xFF);
+	b[1] = (hc_byte)((v >> 8) & 0xFF);
+	b[2] = (hc_byte)((v >> 16) & 0xFF);
+	b[3] = (hc_byte)((v >> 24) & 0xFF);
+
+	hc_write(w, b, 4);
+}
+
+/* writes a 64 bit little endian integer */
+static void hc_write_u64(hc_writer* w, hc_ullong v)
+{
+	hc_write_u32(w, (hc_ulong)(v & 0xFFFFFFFF));
+	hc_write_u32(w, (hc_ulong)(v >> 32));
+}
+
+void hc_write(hc_writer* w, const void* src, size_t size)
+{
+	const hc_byte* in = (const hc_byte*)src;
+
+	/* large writes go straight to the stream */
+	if (size >= w->cap && w->stream != NULL)
+	{
+		double start;
+
+		hc_flush_writer(w);
+		start = w->stats != NULL ? hc_now() : 0;
+		fwrite(in, 1, size, w->stream);
+		w->flushed += size;
+
+		if (w->stats != NULL)
+			w->stats->write_time += hc_now() - start;
+		return;
+	}
+
+	if (!hc_reserve(w, size))
+		return;
+
+	memcpy(w->buf + w->len, in, size);
+	w->len += size;
+}
+
+
+/* metadata */
+static hc_byte table_begin = 1;
+static hc_byte table_byte = 2;
+static hc_byte table_code = 3;
+static hc_byte table_end = 4;
+static hc_byte data_begin = 5;
+static hc_byte data_end = 6;
+static hc_byte table_lengths = 7;
+static hc_byte stream_begin = 8;
+static hc_byte block_begin = 9;
+static hc_byte stream_end = 10;
+static hc_byte index_begin = 11;
+static hc_byte data_streams = 12;
+static hc_byte dict_begin = 13;
+static hc_byte adaptive_begin = 14;
+static hc_byte sync_points = 15;
+static hc_byte block_stored = 16;
+static hc_byte block_rle = 17;
+static hc_byte block_contexts = 18;
+static hc_byte wide_begin = 19;
+static const hc_byte index_magic[4] = { 'H', 'C', 'I', 'X' };
+static const hc_byte codebook_magic[4] = { 'H', 'C', 'C', 'B' };
+
+/* encodings of a length-only table */
+static hc_byte lengths_runs = 0;
+static hc_byte lengths_nibbles = 1;
+
+/* largest length-only table: markers and a run for every byte value */
+#define HC_LENGTHS_BYTES (2 + 2 * (UCHAR_MAX + 1))
+
+void hc_write_table(hc_writer* out_file, hc_sym* table, hc_ulong len)
+{
+	hc_ulong i;
+
+	hc_write_byte(out_file, table_begin);
+
+	for (i = 0; i < len; i++)
+	{
+		/* write the byte */
+		hc_write_byte(out_file, table_byte);
+		hc_write_byte(out_file, table[i].b);
+
+		/* write the bit code metadata */
+		hc_write_byte(out_file, table_code);
+		hc_write(out_file, &(table[i].code->bit_count), sizeof(hc_ulong));
+		hc_write(out_file, &(table[i].code->byte_count), sizeof(hc_ulong));
+		hc_write_byte(out_file, table[i].code->current_bits);
+
+		/* write the bit code data */
+		hc_write(out_file, table[i].code->bytes, table[i].code->byte_count);
+	}
+
+	hc_write_byte(out_file, table_end);
+}
+
+/*
+ * Lays out a length-only table the way hc_write_lengths writes it,
+ * returning its size so that encoders can weigh it up first.
+ */
+static size_t hc_pack_lengths(const hc_sym* table, hc_ulong len,
+	hc_byte* packed)
+{
+	hc_byte lengths[UCHAR_MAX + 1] = { 0 };
+	hc_byte runs[2 * (UCHAR_MAX + 1)];
+	hc_byte nibbles[(UCHAR_MAX + 1) / 2];
+	hc_ulong run_count = 0;
+	hc_ulong max_len = 0;
+	hc_ulong i;
+
+	for (i = 0; i < len; i++)
+	{
+		lengths[table[i].b] = (hc_byte)table[i].code->bit_count;
+		if (table[i].code->bit_count > max_len)
+			max_len = table[i].code->bit_count;
+	}
+
+	/* pairs of (run length - 1, code length) covering every byte value */
+	for (i = 0; i < UCHAR_MAX + 1; i++)
+	{
+		if (i > 0 && lengths[i] == runs[run_count - 1]
+			&& runs[run_count - 2] < UCHAR_MAX)
+		{
+			runs[run_count - 2]++;
+		}
+		else
+		{
+			runs[run_count++] = 0;
+			runs[run_count++] = lengths[i];
+		}
+	}
+
+	packed[0] = table_lengths;
+
+	/* pack two lengths per byte when they fit and that is smaller */
+	if (max_len < 16 && sizeof(nibbles) < run_count)
+	{
+		for (i = 0; i < sizeof(nibbles); i++)
+			nibbles[i] = (hc_byte)(lengths[2 * i] | (lengths[2 * i + 1] << 4));
+
+		packed[1] = lengths_nibbles;
+		memcpy(packed + 2, nibbles, sizeof(nibbles));
+
+		return 2 + sizeof(nibbles);
+	}
+
+	packed[1] = lengths_runs;
+	memcpy(packed + 2, runs, run_count);
+
+	return 2 + run_count;
+}
+
+void hc_write_lengths(hc_writer* out_file, hc_sym* table, hc_ulong len)
+{
+	hc_byte packed[HC_LENGTHS_BYTES];
+
+	hc_write(out_file, packed, hc_pack_lengths(table, len, packed));
+}
+
+static hc_sym* hc_read_lengths(hc_reader* in_stream, size_t* len)
+{
+	hc_byte lengths[UCHAR_MAX + 1];
+	hc_byte nibbles[(UCHAR_MAX + 1) / 2];
+	hc_byte pair[2];
+	int b;
+	hc_ulong i;
+	hc_ulong j;
+
+	b = hc_read_byte(in_stream);
+
+	if (b == lengths_nibbles)
+	{
+		if (hc_read(in_stream, nibbles, sizeof(nibbles)) != sizeof(nibbles))
+			return NULL;
+
+		for (i = 0; i < sizeof(nibbles); i++)
+		{
+			lengths[2 * i] = nibbles[i] & 0xF;
+			lengths[2 * i + 1] = nibbles[i] >> 4;
+		}
+	}
+	else if (b == lengths_runs)
+	{
+		for (i = 0; i < UCHAR_MAX + 1; )
+		{
+			if (hc_read(in_stream, pair, 2) != 2
+				|| i + pair[0] > UCHAR_MAX)
+			{
+				return NULL;
+			}
+			for (j = 0; j <= pair[0]; j++)
+				lengths[i++] = pair[1];
+		}
+	}
+	else
+	{
+		return NULL;
+	}
+
+	hc_sym* table = (hc_sym*)hc_malloc(sizeof(hc_sym) * (UCHAR_MAX + 1));
+	hc_sym* syms[UCHAR_MAX + 1];
+	hc_ulong count = 0;
+
+	for (i = 0; i < UCHAR_MAX + 1; i++)
+	{
+		if (lengths[i] > 0)
+		{
+			table[count].b = (hc_byte)i;
+			table[count].f = 0;
+			table[count].w = 0;
+			table[count].n = lengths[i];
+			table[count].code = hc_create_bitstring();
+			syms[count] = &table[count];
+			count++;
+		}
+	}
+
+	/* rebuild the canonical codes from the lengths */
+	hc_canonical_codes(syms, count);
+
+	*len = count;
+
+	return table;
+}
+
+hc_sym* hc_read_table(hc_reader* in_stream, size_t *len)
+{
+	size_t cap = 10;
+	size_t count = 0;
+	size_t flag = 1;
+
+	hc_sym* table = (hc_sym*)hc_malloc(sizeof(hc_sym) * cap);
 
 	hc_ulong ul; /* long */
-	hc_byte b;   /* byte */
+	int b;       /* byte */
 
-	fread(&b, sizeof(hc_byte), 1, in_stream);
+	b = hc_read_byte(in_stream);
+
+	if (b == table_lengths)
+	{
+		free(table);
+		return hc_read_lengths(in_stream, len);
+	}
 
 	if (b != table_begin)
 	{
@@ -462,355 +1414,4685 @@ hc_sym* hc_read_table(FILE *in_stream, size_t *len)
 
 	while (flag > 0)
 	{
-		flag = fread(&b, sizeof(hc_byte), 1, in_stream);
+		b = hc_read_byte(in_stream);
 
-		if (b == table_byte)
+		if (b == EOF)
 		{
-			flag = fread(&b, sizeof(hc_byte), 1, in_stream);
-			sym.b = b;
+			flag = 0;
+		}
+		else if (b == table_byte)
+		{
+			b = hc_read_byte(in_stream);
+			sym.b = (hc_byte)b;
+			flag = b != EOF;
 		}
 		else if (b == table_code)
 		{
 			sym.code = hc_create_bitstring();
 
-			/* destroy the bytes since we'll recreate them later */
-			free(sym.code->bytes);
+			/* destroy the bytes since we'll recreate them later */
+			free(sym.code->bytes);
+
+			flag = hc_read(in_stream, &ul, sizeof(hc_ulong));
+			sym.code->bit_count = ul;
+
+			flag = hc_read(in_stream, &ul, sizeof(hc_ulong));
+			sym.code->byte_count = ul;
+
+			b = hc_read_byte(in_stream);
+			sym.code->current_bits = (hc_byte)b;
+
+			sym.code->bytes = (hc_byte*)
+				hc_malloc(sizeof(hc_byte) * sym.code->byte_count);
+
+			flag = hc_read(in_stream, sym.code->bytes,
+				sym.code->byte_count);
+
+			/* resize the dictionary if necessary */
+			if (count >= cap)
+			{
+				size_t new_cap = cap + cap / 2;
+				table = (hc_sym*)hc_realloc(table, sizeof(hc_sym) * new_cap);
+				cap = new_cap;
+			}
+
+			/* add the symbol to the dictionary */
+			table[count++] = sym;
+		}
+		else if (b == table_end)
+		{
+			flag = 0;
+		}
+	}
+
+	/* free excess memory */
+	if (count < cap)
+	{
+		table = (hc_sym*)hc_realloc(table, sizeof(hc_sym) * count);
+	}
+
+	*len = count;
+
+	return table;
+}
+
+void hc_write_data(hc_writer* out_stream, hc_bitstring *bs)
+{
+	hc_write_byte(out_stream, data_begin);
+
+	/* write the bit string metadata */
+	hc_write(out_stream, &(bs->bit_count), sizeof(hc_ulong));
+	hc_write(out_stream, &(bs->byte_count), sizeof(hc_ulong));
+	hc_write_byte(out_stream, bs->current_bits);
+
+	/* write the bit code data */
+	hc_write(out_stream, bs->bytes, bs->byte_count);
+
+	hc_write_byte(out_stream, data_end);
+}
+
+/*
+ * Collects bits in a 64 bit accumulator and passes them to
+ * a writer 32 bits at a time, first bit lowest.
+ */
+typedef struct hc_bitwriter {
+	hc_writer* out;
+	hc_ullong acc;
+	unsigned int count;
+} hc_bitwriter;
+
+/* appends up to 32 bits, first bit lowest */
+static void hc_put_bits(hc_bitwriter* bw, hc_ullong bits, unsigned int n)
+{
+	/* the accumulator never holds more than 31 bits between calls */
+	bw->acc |= bits << bw->count;
+	bw->count += n;
+
+	if (bw->count >= 32)
+	{
+		hc_writer* w = bw->out;
+
+		if (w->cap - w->len >= 4 || hc_reserve(w, 4))
+		{
+			w->buf[w->len++] = (hc_byte)bw->acc;
+			w->buf[w->len++] = (hc_byte)(bw->acc >> 8);
+			w->buf[w->len++] = (hc_byte)(bw->acc >> 16);
+			w->buf[w->len++] = (hc_byte)(bw->acc >> 24);
+		}
+
+		bw->acc >>= 32;
+		bw->count -= 32;
+	}
+}
+
+/* writes out the remaining bits, padding the last byte with zeros */
+static void hc_flush_bits(hc_bitwriter* bw)
+{
+	while (bw->count > 0)
+	{
+		hc_write_byte(bw->out, (hc_byte)bw->acc);
+		bw->acc >>= CHAR_BIT;
+		bw->count = bw->count > CHAR_BIT ? bw->count - CHAR_BIT : 0;
+	}
+	bw->acc = 0;
+}
+
+void hc_create_encode_table(hc_sym* table, hc_ulong len,
+	hc_encode_entry* codes)
+{
+	hc_ulong i;
+	hc_ulong j;
+
+	for (i = 0; i < UCHAR_MAX + 1; i++)
+	{
+		codes[i].code = 0;
+		codes[i].len = 0;
+	}
+
+	for (i = 0; i < len; i++)
+	{
+		hc_bitstring* bs = table[i].code;
+		hc_encode_entry* e = &codes[table[i].b];
+
+		for (j = 0; j < bs->byte_count && j < sizeof(hc_ullong); j++)
+			e->code |= (hc_ullong)bs->bytes[j] << (j * CHAR_BIT);
+		e->len = (hc_byte)bs->bit_count;
+	}
+}
+
+void hc_encode_data(hc_writer* out_stream, const hc_byte* data, size_t size,
+	hc_sym* table, hc_ulong len)
+{
+	hc_encode_entry codes[UCHAR_MAX + 1];
+	hc_bitwriter bw;
+	hc_ulong bit_count = 0;
+	hc_ulong byte_count;
+	hc_byte current_bits;
+	const hc_byte* b;
+	const hc_byte* end = data + size;
+	hc_ulong i;
+
+	hc_create_encode_table(table, len, codes);
+
+	/* the size of the encoded data follows from the frequencies */
+	for (i = 0; i < len; i++)
+		bit_count += table[i].f * table[i].code->bit_count;
+
+	/* lay the metadata out the way an hc_bitstring would */
+	byte_count = bit_count > 0 ? (bit_count + CHAR_BIT - 1) / CHAR_BIT : 1;
+	current_bits = (hc_byte)(bit_count - (byte_count - 1) * CHAR_BIT);
+
+	hc_write_byte(out_stream, data_begin);
+	hc_write(out_stream, &bit_count, sizeof(hc_ulong));
+	hc_write(out_stream, &byte_count, sizeof(hc_ulong));
+	hc_write_byte(out_stream, current_bits);
+
+	bw.out = out_stream;
+	bw.acc = 0;
+	bw.count = 0;
+
+	for (b = data; b < end; b++)
+	{
+		const hc_encode_entry* e = &codes[*b];
+
+		if (e->len <= 32)
+		{
+			hc_put_bits(&bw, e->code, e->len);
+		}
+		else
+		{
+			hc_put_bits(&bw, e->code & 0xFFFFFFFF, 32);
+			hc_put_bits(&bw, e->code >> 32, e->len - 32);
+		}
+	}
+
+	hc_flush_bits(&bw);
+
+	if (bit_count == 0)
+		hc_write_byte(out_stream, 0);
+
+	hc_write_byte(out_stream, data_end);
+}
+
+void hc_encode_streams(hc_writer* out_stream, const hc_byte* data,
+	size_t size, hc_sym* table, hc_ulong len)
+{
+	hc_encode_entry codes[UCHAR_MAX + 1];
+	hc_ulong bit_counts[HC_STREAMS] = { 0 };
+	hc_bitwriter bw;
+	size_t i;
+	unsigned int j;
+
+	hc_create_encode_table(table, len, codes);
+
+	/* symbol i goes to stream i % HC_STREAMS */
+	for (i = 0; i < size; i++)
+		bit_counts[i % HC_STREAMS] += codes[data[i]].len;
+
+	hc_write_byte(out_stream, data_streams);
+	for (j = 0; j < HC_STREAMS; j++)
+		hc_write_u32(out_stream, bit_counts[j]);
+
+	/* each stream is written whole, starting on a byte boundary */
+	for (j = 0; j < HC_STREAMS; j++)
+	{
+		bw.out = out_stream;
+		bw.acc = 0;
+		bw.count = 0;
+
+		for (i = j; i < size; i += HC_STREAMS)
+		{
+			const hc_encode_entry* e = &codes[data[i]];
+
+			if (e->len <= 32)
+			{
+				hc_put_bits(&bw, e->code, e->len);
+			}
+			else
+			{
+				hc_put_bits(&bw, e->code & 0xFFFFFFFF, 32);
+				hc_put_bits(&bw, e->code >> 32, e->len - 32);
+			}
+		}
+
+		hc_flush_bits(&bw);
+	}
+
+	hc_write_byte(out_stream, data_end);
+}
+
+hc_bitstring* hc_read_data(hc_reader* in_stream)
+{
+	hc_bitstring* bs = hc_create_bitstring();
+
+	hc_ulong bit_count;
+	hc_ulong byte_count;
+	int b;
+
+	b = hc_read_byte(in_stream);
+
+	if (b == data_begin
+		&& hc_read(in_stream, &bit_count, sizeof(hc_ulong)) == sizeof(hc_ulong)
+		&& hc_read(in_stream, &byte_count, sizeof(hc_ulong)) == sizeof(hc_ulong)
+		&& (b = hc_read_byte(in_stream)) != EOF)
+	{
+		bs->current_bits = (hc_byte)b;
+
+		/* dispose of this since we create it here */
+		free(bs->bytes);
+		bs->bytes = (hc_byte*)hc_malloc(sizeof(hc_byte) * byte_count + 1);
+
+		bs->byte_count = hc_read(in_stream, bs->bytes, byte_count);
+
+		/* never claim more bits than were actually read */
+		bs->bit_count = bit_count;
+		if (bs->bit_count > bs->byte_count * CHAR_BIT)
+			bs->bit_count = bs->byte_count * CHAR_BIT;
+
+		/* consume the end marker */
+		hc_read_byte(in_stream);
+	}
+
+	return bs;
+}
+
+static void hc_build_branch(hc_node** node, hc_byte* bytes, hc_sym data,
+	hc_byte byte, hc_ulong bit, hc_ulong bit_count, hc_ulong bit_cap)
+{
+	if (bit_count == bit_cap)
+	{
+		if (*node == NULL)
+		{
+			*node = hc_create_node();
+		}
+
+		/* the leaf gets its own copy of the code */
+		(*node)->sym = data;
+		(*node)->sym.w = 0;
+		(*node)->sym.code = hc_create_bitstring();
+		hc_add_bits((*node)->sym.code, data.code);
+
+		return;
+	}
+
+	if (bit == CHAR_BIT)
+	{
+		byte++;
+		bit = 0;
+	}
+
+	hc_node** leaf;
+
+	if (bytes[byte] & (1 << bit++))
+		leaf = &((*node)->leaf_1);
+	else
+		leaf = &((*node)->leaf_2);
+
+	if (*leaf == NULL)
+	{
+		*leaf = hc_create_node();
+		(*leaf)->sym.w = 1;
+	}
+
+	hc_build_branch(leaf, bytes, data, byte, bit, ++bit_count, bit_cap);
+}
+
+hc_node_list* hc_reconstruct_tree(hc_sym* table, hc_ulong len)
+{
+	hc_ulong i;
+	hc_node_list* tree = hc_create_list();
+
+	hc_node* root = hc_create_node();
+	root->sym.w = 1;
+
+	hc_add_node(tree, root);
+
+	/*
+	 * leaf_1 => 1
+	 * leaf_2 => 0
+	 */
+
+	for (i = 0; i < len; i++)
+	{
+		hc_bitstring* bs = table[i].code;
+
+		hc_build_branch(&root, bs->bytes, table[i],
+			0,            /* current byte              */
+			0,            /* position in current byte  */
+			0,            /* current bit count         */
+			bs->bit_count /* bit capactity             */
+		);
+	}
+
+	return tree;
+}
+
+/*
+ * Gives a decoder a multi-symbol table if the codes are short enough
+ * for it to pay. Each entry holds the codes that start an
+ * HC_DECODE_BITS bit index and end within it, found with the primary
+ * table. A code of n bits stands for about 2^-n of the data, as much
+ * as its share of the indices, so the average over the entries is
+ * what a probe can be expected to decode.
+ */
+static void hc_build_multi(hc_decoder* dec)
+{
+	hc_ulong size = (hc_ulong)1 << HC_DECODE_BITS;
+	hc_ulong mask = ((hc_ulong)1 << dec->bits) - 1;
+	hc_ullong total = 0;
+	hc_ulong i;
+
+	dec->multi = (hc_multi_entry*)hc_calloc(size, sizeof(hc_multi_entry));
+
+	for (i = 0; i < size; i++)
+	{
+		hc_multi_entry* m = &dec->multi[i];
+		unsigned int used = 0;
+
+		while (m->count < HC_MULTI_SYMBOLS)
+		{
+			hc_decode_entry e = dec->entries[(i >> used) & mask];
+
+			/* the bits past the index are not known */
+			if (e.len == 0 || e.len > HC_DECODE_BITS - used)
+				break;
+
+			m->syms[m->count++] = (hc_byte)e.sym;
+			used += e.len;
+		}
+
+		m->len = (hc_byte)used;
+		total += m->count;
+	}
+
+	if (total * 256 < (hc_ullong)HC_MULTI_MIN_AVERAGE * size)
+	{
+		free(dec->multi);
+		dec->multi = NULL;
+	}
+}
+
+hc_decoder* hc_create_decoder(hc_sym* table, hc_ulong len)
+{
+	hc_decoder* dec = (hc_decoder*)hc_malloc(sizeof(hc_decoder));
+	hc_ulong i;
+	hc_ulong j;
+	hc_ulong max_len = 0;
+
+	dec->entries = NULL;
+	dec->size = 0;
+	dec->bits = 0;
+	dec->tree = NULL;
+	dec->multi = NULL;
+
+	for (i = 0; i < len; i++)
+	{
+		if (table[i].code->bit_count > max_len)
+			max_len = table[i].code->bit_count;
+	}
+
+	if (max_len > HC_DECODE_MAX_BITS)
+	{
+		dec->tree = hc_reconstruct_tree(table, len);
+		return dec;
+	}
+
+	dec->bits = max_len < HC_DECODE_BITS ? (unsigned int)max_len : HC_DECODE_BITS;
+	if (dec->bits == 0)
+		dec->bits = 1;
+
+	hc_ulong primary = (hc_ulong)1 << dec->bits;
+	hc_ulong mask = primary - 1;
+	hc_ulong* codes = (hc_ulong*)hc_malloc(sizeof(hc_ulong) * (len + 1));
+	hc_byte* sub_bits = (hc_byte*)hc_calloc(primary, sizeof(hc_byte));
+
+	/* pack the codes so that the first bit of a code is its lowest bit */
+	for (i = 0; i < len; i++)
+	{
+		hc_bitstring* bs = table[i].code;
+		hc_ulong v = 0;
+		for (j = 0; j < bs->bit_count; j++)
+		{
+			if (bs->bytes[j / CHAR_BIT] & (1 << (j % CHAR_BIT)))
+				v |= (hc_ulong)1 << j;
+		}
+		codes[i] = v;
+
+		/* find the widest secondary table needed under each prefix */
+		if (bs->bit_count > dec->bits
+			&& bs->bit_count - dec->bits > sub_bits[v & mask])
+		{
+			sub_bits[v & mask] = (hc_byte)(bs->bit_count - dec->bits);
+		}
+	}
+
+	/* lay out the secondary tables after the primary table */
+	dec->size = primary;
+	for (i = 0; i < primary; i++)
+	{
+		if (sub_bits[i] > 0)
+			dec->size += (hc_ulong)1 << sub_bits[i];
+	}
+
+	dec->entries = (hc_decode_entry*)
+		hc_calloc(dec->size, sizeof(hc_decode_entry));
+
+	hc_ulong offset = primary;
+	for (i = 0; i < primary; i++)
+	{
+		if (sub_bits[i] > 0)
+		{
+			dec->entries[i].sym = (hc_ushort)offset;
+			dec->entries[i].sub = sub_bits[i];
+			offset += (hc_ulong)1 << sub_bits[i];
+		}
+	}
+
+	/* secondary table offsets must fit in an entry */
+	if (dec->size > (hc_ulong)USHRT_MAX + 1)
+	{
+		free(dec->entries);
+		dec->entries = NULL;
+		dec->size = 0;
+		dec->tree = hc_reconstruct_tree(table, len);
+	}
+
+	/* replicate each code over every index that starts with it */
+	for (i = 0; i < len && dec->entries != NULL; i++)
+	{
+		hc_ulong n = table[i].code->bit_count;
+		hc_decode_entry e;
+
+		if (n == 0)
+			continue;
+
+		e.sym = table[i].b;
+		e.len = (hc_byte)n;
+		e.sub = 0;
+
+		if (n <= dec->bits)
+		{
+			for (j = codes[i]; j < primary; j += (hc_ulong)1 << n)
+				dec->entries[j] = e;
+		}
+		else
+		{
+			hc_decode_entry link = dec->entries[codes[i] & mask];
+			hc_ulong size = (hc_ulong)1 << link.sub;
+			hc_ulong extra = n - dec->bits;
+			for (j = codes[i] >> dec->bits; j < size; j += (hc_ulong)1 << extra)
+				dec->entries[link.sym + j] = e;
+		}
+	}
+
+	free(codes);
+	free(sub_bits);
+
+	if (dec->entries != NULL)
+		hc_build_multi(dec);
+
+	return dec;
+}
+
+void hc_destroy_decoder(hc_decoder* dec)
+{
+	if (dec == NULL)
+		return;
+
+	free(dec->entries);
+	free(dec->multi);
+	hc_destroy_list(dec->tree);
+	free(dec);
+}
+
+/* reads bits from memory, first bit lowest */
+typedef struct hc_bitreader {
+	const hc_byte* in;
+	const hc_byte* end;
+	hc_ullong buf;      /* bits not yet consumed, next bit lowest */
+	unsigned int count; /* number of bits in buf                   */
+	size_t pad;         /* zero bytes added past the end           */
+} hc_bitreader;
+
+static void hc_init_bits(hc_bitreader* br, const hc_byte* in, size_t size)
+{
+	br->in = in;
+	br->end = in + size;
+	br->buf = 0;
+	br->count = 0;
+	br->pad = 0;
+}
+
+/* tops the bit buffer up to at least 57 bits, padding with zeros */
+static void hc_refill_bits(hc_bitreader* br)
+{
+	while (br->count <= 56)
+	{
+		if (br->in < br->end)
+			br->buf |= (hc_ullong)*br->in++ << br->count;
+		else
+			br->pad++;
+		br->count += CHAR_BIT;
+	}
+}
+
+/*
+ * Looks up the next code in a decoder's tables. The bit buffer must
+ * hold at least HC_DECODE_MAX_BITS bits. Returns a zero length entry
+ * for bits that do not start any code.
+ */
+static hc_decode_entry hc_lookup(hc_decoder* dec, hc_ullong buf)
+{
+	hc_decode_entry e = dec->entries[buf & (((hc_ulong)1 << dec->bits) - 1)];
+
+	if (e.sub > 0)
+	{
+		e = dec->entries[e.sym
+			+ ((buf >> dec->bits) & (((hc_ulong)1 << e.sub) - 1))];
+	}
+
+	return e;
+}
+
+/* walks the tree of a decoder one bit at a time, returning -1 on errors */
+static int hc_walk_symbol(hc_decoder* dec, hc_bitreader* br)
+{
+	hc_node* leaf = dec->tree->nodes;
+
+	while (leaf != NULL && leaf->sym.w != 0)
+	{
+		if (br->count == 0)
+			hc_refill_bits(br);
+
+		leaf = (br->buf & 1) ? leaf->leaf_1 : leaf->leaf_2;
+		br->buf >>= 1;
+		br->count--;
+	}
+
+	return leaf != NULL ? leaf->sym.b : -1;
+}
+
+static void hc_decode_tree(hc_bitstring* bs, hc_node_list* tree,
+	hc_writer* out_stream)
+{
+	hc_node* root = tree->nodes;
+	hc_node* leaf = root;
+
+	hc_ulong i;
+
+	for (i = 0; i <= bs->bit_count && leaf != NULL; i++)
+	{
+		if (leaf->sym.w == 0)
+		{
+			hc_write_byte(out_stream, leaf->sym.b);
+			leaf = root;
+			i--;
+		}
+		else if (i < bs->bit_count)
+		{
+			if (bs->bytes[i / CHAR_BIT] & (1 << (i % CHAR_BIT)))
+				leaf = leaf->leaf_1;
+			else
+				leaf = leaf->leaf_2;
+		}
+	}
+}
+
+void hc_decode_data(hc_bitstring* bs, hc_decoder* dec, hc_writer* out_stream)
+{
+	if (dec->entries == NULL)
+	{
+		hc_decode_tree(bs, dec->tree, out_stream);
+		return;
+	}
+
+	hc_bitreader br;
+	hc_ulong left = bs->bit_count;
+
+	hc_init_bits(&br, bs->bytes, bs->byte_count);
+
+	while (left > 0)
+	{
+		hc_refill_bits(&br);
+
+		/*
+		 * a refill holds four probes of the multi-symbol table, each
+		 * of which stores HC_MULTI_SYMBOLS bytes and keeps the ones
+		 * it decoded
+		 */
+		if (dec->multi != NULL && left >= 4 * HC_DECODE_BITS
+			&& out_stream->cap - out_stream->len >= 4 * HC_MULTI_SYMBOLS)
+		{
+			hc_byte* out = out_stream->buf + out_stream->len;
+			unsigned int k;
+
+			for (k = 0; k < 4; k++)
+			{
+				const hc_multi_entry* m = &dec->multi[br.buf
+					& (((hc_ulong)1 << HC_DECODE_BITS) - 1)];
+
+				if (m->count == 0)
+					break;
+
+				memcpy(out, m->syms, HC_MULTI_SYMBOLS);
+				out += m->count;
+				br.buf >>= m->len;
+				br.count -= m->len;
+				left -= m->len;
+			}
+
+			out_stream->len = out - out_stream->buf;
+
+			/* a long code is left to the lookup below */
+			if (k == 4)
+				continue;
+		}
+
+		hc_decode_entry e = hc_lookup(dec, br.buf);
+
+		/* stop on corrupt data rather than run past the end */
+		if (e.len == 0 || e.len > left)
+			break;
+
+		br.buf >>= e.len;
+		br.count -= e.len;
+		left -= e.len;
+
+		/* decoded bytes go straight into the output buffer */
+		if (out_stream->len == out_stream->cap && !hc_reserve(out_stream, 1))
+			break;
+		out_stream->buf[out_stream->len++] = (hc_byte)e.sym;
+	}
+}
+
+int hc_decode_streams(const hc_byte* data, const hc_ulong* bit_counts,
+	size_t symbols, hc_decoder* dec, hc_writer* out_stream)
+{
+	hc_bitreader br[HC_STREAMS];
+	hc_ullong used[HC_STREAMS] = { 0 };
+	size_t rounds = symbols / HC_STREAMS;
+	size_t r;
+	unsigned int j;
+	int bad = 0;
+
+	for (j = 0; j < HC_STREAMS; j++)
+	{
+		size_t size = (bit_counts[j] + CHAR_BIT - 1) / CHAR_BIT;
+		hc_init_bits(&br[j], data, size);
+		data += size;
+	}
+
+	if (dec->entries == NULL)
+	{
+		/* codes too long for the tables are walked one bit at a time */
+		for (r = 0; r < symbols; r++)
+		{
+			int sym = hc_walk_symbol(dec, &br[r % HC_STREAMS]);
+
+			if (sym < 0)
+				return 0;
+
+			hc_write_byte(out_stream, (hc_byte)sym);
+		}
+
+		return !out_stream->error;
+	}
+
+	/*
+	 * Each refill leaves at least 57 bits per stream, enough for two
+	 * codes of up to HC_DECODE_MAX_BITS bits, so two rounds of one
+	 * symbol per stream run between refills. The streams do not depend
+	 * on each other, so their lookups can overlap.
+	 */
+	for (r = 0; r < rounds; r += 2)
+	{
+		unsigned int n = rounds - r >= 2 ? 2 * HC_STREAMS : HC_STREAMS;
+		unsigned int k;
+
+		if (out_stream->cap - out_stream->len < n && !hc_reserve(out_stream, n))
+			return 0;
+
+		hc_byte* out = out_stream->buf + out_stream->len;
+
+		for (j = 0; j < HC_STREAMS; j++)
+			hc_refill_bits(&br[j]);
+
+		for (k = 0; k < n; k++)
+		{
+			hc_bitreader* b = &br[k % HC_STREAMS];
+			hc_decode_entry e = hc_lookup(dec, b->buf);
+
+			bad |= e.len == 0;
+			b->buf >>= e.len;
+			b->count -= e.len;
+			used[k % HC_STREAMS] += e.len;
+			out[k] = (hc_byte)e.sym;
+		}
+
+		out_stream->len += n;
+	}
+
+	/* the last symbols go to the first streams */
+	for (j = 0; j < symbols % HC_STREAMS; j++)
+	{
+		hc_refill_bits(&br[j]);
+
+		hc_decode_entry e = hc_lookup(dec, br[j].buf);
+
+		bad |= e.len == 0;
+		br[j].buf >>= e.len;
+		br[j].count -= e.len;
+		used[j] += e.len;
+		hc_write_byte(out_stream, (hc_byte)e.sym);
+	}
+
+	/* every stream must end exactly where its bit count says */
+	for (j = 0; j < HC_STREAMS; j++)
+		bad |= used[j] != bit_counts[j];
+
+	return !bad && !out_stream->error;
+}
+
+/* number of count tables the histogram spreads neighbouring bytes over */
+#define HC_HISTOGRAM_TABLES 4
+
+/* bytes counted into 32 bit tables before they are added to the totals */
+#define HC_HISTOGRAM_CHUNK 0x40000000
+
+/* counts the 8 bytes of a little endian word into the count tables */
+#define HC_COUNT_WORD(t, w) \
+	do { \
+		t[0][(w) & 0xFF]++; \
+		t[1][((w) >> 8) & 0xFF]++; \
+		t[2][((w) >> 16) & 0xFF]++; \
+		t[3][((w) >> 24) & 0xFF]++; \
+		t[0][((w) >> 32) & 0xFF]++; \
+		t[1][((w) >> 40) & 0xFF]++; \
+		t[2][((w) >> 48) & 0xFF]++; \
+		t[3][((w) >> 56) & 0xFF]++; \
+	} while (0)
+
+/*
+ * Counts a chunk of at most HC_HISTOGRAM_CHUNK bytes. Runs of the
+ * same byte go to different tables, so one increment need not wait
+ * for the store of the one before it.
+ *
+ * The loop is bound by the increments, not the loads: SSE2 and AVX2
+ * have no scatter to count with, so vector loads would only be split
+ * back into the same words, and were measured to gain nothing.
+ */
+static void hc_count_chunk(const hc_byte* data, size_t size,
+	hc_uint t[HC_HISTOGRAM_TABLES][UCHAR_MAX + 1])
+{
+	const hc_byte* end = data + size;
+
+	while (end - data >= 8)
+	{
+		hc_ullong w;
+
+		/* byte order only decides which table a byte lands in */
+		memcpy(&w, data, sizeof(w));
+		HC_COUNT_WORD(t, w);
+		data += 8;
+	}
+
+	while (data < end)
+		t[0][*data++]++;
+}
+
+void hc_histogram(const hc_byte* data, size_t size, hc_ulong* counts)
+{
+	hc_uint t[HC_HISTOGRAM_TABLES][UCHAR_MAX + 1];
+	hc_ulong i;
+
+	for (i = 0; i < UCHAR_MAX + 1; i++)
+		counts[i] = 0;
+
+	while (size > 0)
+	{
+		size_t n = size < HC_HISTOGRAM_CHUNK ? size : HC_HISTOGRAM_CHUNK;
+
+		memset(t, 0, sizeof(t));
+		hc_count_chunk(data, n, t);
+
+		/* add up the tables */
+		for (i = 0; i < UCHAR_MAX + 1; i++)
+			t[0][i] += t[1][i] + t[2][i] + t[3][i];
+
+		for (i = 0; i < UCHAR_MAX + 1; i++)
+			counts[i] += t[0][i];
+
+		data += n;
+		size -= n;
+	}
+}
+
+/*
+ * Builds canonical codes for the bytes with a nonzero count, in an
+ * arena that is reset first, and fills in a dictionary of them in
+ * byte order. Codes are limited to max_code_len bits unless it is 0.
+ * Returns the number of codes; extra_bits receives the number of
+ * bits the limit adds.
+ */
+static hc_ulong hc_build_codes(const hc_ulong* counts, hc_ulong max_code_len,
+	hc_arena* arena, hc_sym* dict, hc_ullong* extra_bits)
+{
+	hc_ulong unique = 0;
+	hc_ulong i;
+	hc_node_list* tree;
+
+	*extra_bits = 0;
+
+	/* the nodes and codes of the tree all live in the arena */
+	hc_reset_arena(arena);
+	tree = hc_arena_list(arena);
+
+	/* create a leaf node for each byte that occurs */
+	for (i = 0; i < UCHAR_MAX + 1; i++)
+	{
+		if (counts[i] > 0)
+		{
+			hc_node* node = hc_arena_node(arena);
+			node->sym.b = (hc_byte)i;
+			node->sym.f = counts[i];
+			node->sym.w = 0;
+			node->sym.n = 1;
+			node->sym.code = hc_arena_bitstring(arena);
+			hc_add_node(tree, node);
+			dict[unique++].code = node->sym.code;
+		}
+	}
+
+	/* sort the leave by frequency */
+	hc_sort_leaves(tree);
+
+	/* construct the tree */
+	hc_construct_tree(tree);
+
+	/* assign bit codes to the leaves */
+	hc_assign_codes(tree);
+
+	/* populate the bit code dictionary with bit codes */
+	for (i = 0, unique = 0; i < UCHAR_MAX + 1; i++)
+	{
+		if (counts[i] > 0)
+		{
+			dict[unique].b = (hc_byte)i;
+			dict[unique].f = counts[i];
+			dict[unique].w = 0;
+			dict[unique].n = dict[unique].code->bit_count;
+			unique++;
+		}
+	}
+
+	/* shorten the longest codes if the tree grew too deep */
+	if (max_code_len > 0)
+	{
+		/* a cap below log2 of the symbol count cannot be met */
+		while (max_code_len < HC_MAX_CODE_LEN
+			&& ((hc_ulong)1 << max_code_len) < unique)
+		{
+			max_code_len++;
+		}
+
+		hc_limit_code_lengths(dict, unique, max_code_len, extra_bits);
+	}
+
+	return unique;
+}
+
+/*
+ * Derives the ID of a codebook from its code lengths, so that equal
+ * tables get equal IDs. The ID is never 0.
+ */
+static hc_ulong hc_codebook_id(const hc_codebook* book)
+{
+	hc_ulong hash = 2166136261UL;
+	hc_ulong i;
+
+	/* 32 bit FNV-1a over the code length of each byte value */
+	for (i = 0; i < UCHAR_MAX + 1; i++)
+		hash = ((hash ^ book->codes[i].len) * 16777619UL) & 0xFFFFFFFFUL;
+
+	return hash != 0 ? hash : 1;
+}
+
+hc_codebook* hc_create_codebook(const hc_ulong* counts, hc_ulong max_code_len)
+{
+	hc_codebook* book = (hc_codebook*)hc_malloc(sizeof(hc_codebook));
+	hc_ulong smoothed[UCHAR_MAX + 1];
+	hc_ullong extra_bits;
+	hc_ulong i;
+
+	/* every byte gets a code, however rare it was in the histogram */
+	for (i = 0; i < UCHAR_MAX + 1; i++)
+		smoothed[i] = counts != NULL && counts[i] > 0 ? counts[i] : 1;
+
+	if (max_code_len == 0 || max_code_len > HC_DECODE_MAX_BITS)
+		max_code_len = HC_DECODE_MAX_BITS;
+
+	book->arena = hc_create_arena();
+	book->len = hc_build_codes(smoothed, max_code_len, book->arena,
+		book->table, &extra_bits);
+
+	hc_create_encode_table(book->table, book->len, book->codes);
+	book->decoder = hc_create_decoder(book->table, book->len);
+	book->id = hc_codebook_id(book);
+
+	return book;
+}
+
+hc_codebook* hc_read_codebook(FILE* in_stream)
+{
+	hc_reader* in = hc_create_reader(in_stream);
+	hc_codebook* book = NULL;
+	hc_sym* dict = NULL;
+	size_t len = 0;
+	hc_byte magic[sizeof(codebook_magic)];
+	hc_ulong id = 0;
+	size_t i;
+	int ok;
+
+	if (hc_read(in, magic, sizeof(magic)) == sizeof(magic)
+		&& memcmp(magic, codebook_magic, sizeof(magic)) == 0
+		&& hc_read_u32(in, &id))
+	{
+		dict = hc_read_table(in, &len);
+	}
+
+	hc_destroy_reader(in);
+
+	/* a codebook holds a code for every byte value, none too long */
+	ok = dict != NULL && len == UCHAR_MAX + 1;
+	for (i = 0; ok && i < len; i++)
+		ok = dict[i].code->bit_count <= HC_DECODE_MAX_BITS;
+
+	if (ok)
+	{
+		book = (hc_codebook*)hc_malloc(sizeof(hc_codebook));
+		book->arena = hc_create_arena();
+		book->len = len;
+
+		for (i = 0; i < len; i++)
+		{
+			book->table[i] = dict[i];
+			book->table[i].code = hc_arena_bitstring(book->arena);
+			hc_add_bits(book->table[i].code, dict[i].code);
+		}
+
+		hc_create_encode_table(book->table, book->len, book->codes);
+		book->decoder = hc_create_decoder(book->table, book->len);
+		book->id = hc_codebook_id(book);
+
+		/* the stored ID doubles as a check of the table */
+		if (book->id != id)
+		{
+			hc_destroy_codebook(book);
+			book = NULL;
+		}
+	}
+
+	if (dict != NULL)
+	{
+		for (i = 0; i < len; i++)
+			hc_destroy_bitstring(dict[i].code);
+		free(dict);
+	}
+
+	return book;
+}
+
+int hc_write_codebook(FILE* out_stream, const hc_codebook* book)
+{
+	hc_writer* out = hc_create_writer(out_stream);
+	int ok;
+
+	hc_write(out, codebook_magic, sizeof(codebook_magic));
+	hc_write_u32(out, book->id);
+	hc_write_lengths(out, (hc_sym*)book->table, book->len);
+
+	ok = hc_flush_writer(out);
+	hc_destroy_writer(out);
+
+	return ok;
+}
+
+void hc_destroy_codebook(hc_codebook* book)
+{
+	if (book == NULL)
+		return;
+
+	hc_destroy_decoder(book->decoder);
+	hc_destroy_arena(book->arena);
+	free(book);
+}
+
+size_t hc_codebook_bound(const hc_codebook* book, size_t len)
+{
+	hc_ulong max_len = 0;
+	hc_ulong i;
+
+	for (i = 0; i < UCHAR_MAX + 1; i++)
+	{
+		if (book->codes[i].len > max_len)
+			max_len = book->codes[i].len;
+	}
+
+	/* the length prefix takes at most ten bytes */
+	return 10 + (len / CHAR_BIT) * max_len
+		+ ((len % CHAR_BIT) * max_len + CHAR_BIT - 1) / CHAR_BIT;
+}
+
+size_t hc_codebook_encode(const hc_codebook* book, const void* src,
+	size_t len, void* dst, size_t cap)
+{
+	const hc_byte* in = (const hc_byte*)src;
+	hc_writer out;
+	hc_bitwriter bw;
+	hc_ullong n = len;
+	size_t i;
+
+	/* a writer on the stack keeps the call free of allocations */
+	out.stream = NULL;
+	out.buf = (hc_byte*)dst;
+	out.cap = cap;
+	out.len = 0;
+	out.flushed = 0;
+	out.fixed = 1;
+	out.error = 0;
+	out.stats = NULL;
+
+	/* the message length, seven bits per byte, lowest first */
+	do
+	{
+		hc_write_byte(&out, (hc_byte)((n & 0x7F) | (n > 0x7F ? 0x80 : 0)));
+		n >>= 7;
+	} while (n > 0);
+
+	bw.out = &out;
+	bw.acc = 0;
+	bw.count = 0;
+
+	/* codes of a codebook are never longer than 32 bits */
+	for (i = 0; i < len && !out.error; i++)
+		hc_put_bits(&bw, book->codes[in[i]].code, book->codes[in[i]].len);
+
+	hc_flush_bits(&bw);
+
+	return out.error ? HC_BUFFER_ERROR : out.len;
+}
+
+size_t hc_codebook_decode(const hc_codebook* book, const void* src,
+	size_t len, void* dst, size_t cap)
+{
+	const hc_byte* in = (const hc_byte*)src;
+	hc_byte* out = (hc_byte*)dst;
+	hc_decoder* dec = book->decoder;
+	hc_bitreader br;
+	hc_ullong size = 0;
+	hc_ullong i;
+	size_t pos = 0;
+	unsigned int shift = 0;
+
+	/* read the message length */
+	do
+	{
+		if (pos == len || shift >= sizeof(size) * CHAR_BIT)
+			return HC_BUFFER_ERROR;
+
+		size |= (hc_ullong)(in[pos] & 0x7F) << shift;
+		shift += 7;
+	} while (in[pos++] & 0x80);
+
+	if (size > cap)
+		return HC_BUFFER_ERROR;
+
+	hc_init_bits(&br, in + pos, len - pos);
+
+	if (dec->entries == NULL)
+	{
+		for (i = 0; i < size; i++)
+		{
+			int sym = hc_walk_symbol(dec, &br);
+
+			if (sym < 0)
+				return HC_BUFFER_ERROR;
+
+			out[i] = (hc_byte)sym;
+		}
+	}
+
+	/* each refill holds at least two codes of up to HC_DECODE_MAX_BITS */
+	for (i = 0; dec->entries != NULL && i < size; )
+	{
+		hc_decode_entry e;
+
+		/*
+		 * as in hc_decode_data, a refill holds four probes of the
+		 * multi-symbol table, which store HC_MULTI_SYMBOLS bytes each
+		 */
+		if (dec->multi != NULL && size - i >= 4 * HC_MULTI_SYMBOLS)
+		{
+			unsigned int k;
+
+			hc_refill_bits(&br);
+
+			for (k = 0; k < 4; k++)
+			{
+				const hc_multi_entry* m = &dec->multi[br.buf
+					& (((hc_ulong)1 << HC_DECODE_BITS) - 1)];
+
+				if (m->count == 0)
+					break;
+
+				memcpy(out + i, m->syms, HC_MULTI_SYMBOLS);
+				i += m->count;
+				br.buf >>= m->len;
+				br.count -= m->len;
+			}
+
+			/* a long code is left to the lookup below */
+			if (k == 4)
+				continue;
+		}
+
+		if (br.count < HC_DECODE_MAX_BITS)
+			hc_refill_bits(&br);
+
+		e = hc_lookup(dec, br.buf);
+
+		if (e.len == 0)
+			return HC_BUFFER_ERROR;
+
+		br.buf >>= e.len;
+		br.count -= e.len;
+		out[i++] = (hc_byte)e.sym;
+	}
+
+	/* the codes must not run into the padding past the input */
+	if ((hc_ullong)br.pad * CHAR_BIT > br.count)
+		return HC_BUFFER_ERROR;
+
+	return (size_t)size;
+}
+
+int hc_count_file(FILE* in_stream, hc_ulong* counts)
+{
+	hc_byte* buf = (hc_byte*)hc_malloc(HC_IO_BUFFER);
+	hc_ulong part[UCHAR_MAX + 1];
+	size_t n;
+	hc_ulong i;
+
+	while ((n = fread(buf, 1, HC_IO_BUFFER, in_stream)) > 0)
+	{
+		hc_histogram(buf, n, part);
+		for (i = 0; i < UCHAR_MAX + 1; i++)
+			counts[i] += part[i];
+	}
+
+	free(buf);
+
+	return !ferror(in_stream);
+}
+
+size_t hc_dict_bound(const hc_codebook* book, size_t len)
+{
+	return 1 + 4 + hc_codebook_bound(book, len);
+}
+
+size_t hc_dict_encode(const hc_codebook* book, const void* src, size_t len,
+	void* dst, size_t cap)
+{
+	hc_byte* out = (hc_byte*)dst;
+	size_t size;
+
+	if (cap < 1 + 4)
+		return HC_BUFFER_ERROR;
+
+	/* the dictionary ID takes the place of a table */
+	out[0] = dict_begin;
+	out[1] = (hc_byte)book->id;
+	out[2] = (hc_byte)(book->id >> 8);
+	out[3] = (hc_byte)(book->id >> 16);
+	out[4] = (hc_byte)(book->id >> 24);
+
+	size = hc_codebook_encode(book, src, len, out + 5, cap - 5);
+
+	return size == HC_BUFFER_ERROR ? size : size + 5;
+}
+
+int hc_dict_info(const void* src, size_t len, hc_ulong* id, hc_ullong* size)
+{
+	const hc_byte* in = (const hc_byte*)src;
+	unsigned int shift = 0;
+	size_t pos = 5;
+
+	if (len < 6 || in[0] != dict_begin)
+		return 0;
+
+	*id = hc_get_u32(in + 1);
+	*size = 0;
+
+	do
+	{
+		if (pos == len || shift >= sizeof(*size) * CHAR_BIT)
+			return 0;
+
+		*size |= (hc_ullong)(in[pos] & 0x7F) << shift;
+		shift += 7;
+	} while (in[pos++] & 0x80);
+
+	return 1;
+}
+
+size_t hc_dict_decode(const hc_registry* registry, const void* src,
+	size_t len, void* dst, size_t cap)
+{
+	const hc_codebook* book;
+	hc_ulong id;
+	hc_ullong size;
+
+	if (!hc_dict_info(src, len, &id, &size))
+		return HC_BUFFER_ERROR;
+
+	book = hc_find_codebook(registry, id);
+	if (book == NULL)
+		return HC_BUFFER_ERROR;
+
+	return hc_codebook_decode(book, (const hc_byte*)src + 5, len - 5, dst, cap);
+}
+
+hc_registry* hc_create_registry()
+{
+	hc_registry* registry = (hc_registry*)hc_malloc(sizeof(hc_registry));
+
+	registry->books = NULL;
+	registry->count = 0;
+	registry->cap = 0;
+
+	return registry;
+}
+
+void hc_destroy_registry(hc_registry* registry)
+{
+	hc_ulong i;
+
+	if (registry == NULL)
+		return;
+
+	for (i = 0; i < registry->count; i++)
+		hc_destroy_codebook(registry->books[i]);
+
+	free(registry->books);
+	free(registry);
+}
+
+/* finds where a codebook ID is or would go in the sorted registry */
+static hc_ulong hc_registry_slot(const hc_registry* registry, hc_ulong id)
+{
+	hc_ulong lo = 0;
+	hc_ulong hi = registry->count;
+
+	while (lo < hi)
+	{
+		hc_ulong mid = lo + (hi - lo) / 2;
+
+		if (registry->books[mid]->id < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+int hc_register_codebook(hc_registry* registry, hc_codebook* book)
+{
+	hc_ulong slot = hc_registry_slot(registry, book->id);
+
+	if (slot < registry->count && registry->books[slot]->id == book->id)
+		return 0;
+
+	if (registry->count == registry->cap)
+	{
+		registry->cap = registry->cap > 0 ? registry->cap * 2 : 8;
+		registry->books = (hc_codebook**)hc_realloc(registry->books,
+			sizeof(hc_codebook*) * registry->cap);
+	}
+
+	memmove(registry->books + slot + 1, registry->books + slot,
+		sizeof(hc_codebook*) * (registry->count - slot));
+	registry->books[slot] = book;
+	registry->count++;
+
+	return 1;
+}
+
+hc_codebook* hc_find_codebook(const hc_registry* registry, hc_ulong id)
+{
+	hc_ulong slot = hc_registry_slot(registry, id);
+
+	if (slot < registry->count && registry->books[slot]->id == id)
+		return registry->books[slot];
+
+	return NULL;
+}
+
+/*
+ * Writes where in the data of a block every interval-th byte starts,
+ * so that a range of the block can be decoded without the bytes
+ * before it. The offsets are in bits from the start of the data.
+ */
+static void hc_write_sync_points(hc_writer* out, const hc_byte* block,
+	size_t size, const hc_sym* dict, hc_ulong unique, hc_ulong interval)
+{
+	hc_byte lens[UCHAR_MAX + 1] = { 0 };
+	hc_ulong count;
+	hc_ulong bits = 0;
+	size_t i;
+	hc_ulong k;
+
+	if (interval < HC_MIN_SYNC_INTERVAL)
+		interval = HC_MIN_SYNC_INTERVAL;
+	count = size > 0 ? (hc_ulong)((size - 1) / interval) : 0;
+
+	for (k = 0; k < unique; k++)
+		lens[dict[k].b] = (hc_byte)dict[k].code->bit_count;
+
+	hc_write_byte(out, sync_points);
+	hc_write_u32(out, interval);
+	hc_write_u32(out, count);
+
+	for (i = 0, k = 0; k < count; k++)
+	{
+		for (; i < (k + 1) * interval; i++)
+			bits += lens[block[i]];
+
+		hc_write_u32(out, bits);
+	}
+}
+
+/* log2 of x in 1/256ths of a bit, straight between powers of two */
+static hc_ulong hc_log2_fixed(hc_ullong x)
+{
+	hc_ulong p = 0;
+
+	while (x >> p > 1)
+		p++;
+
+	if (p >= 8)
+		return p * 256 + (hc_ulong)((x >> (p - 8)) & 0xFF);
+
+	return p * 256 + (hc_ulong)((x << (8 - p)) & 0xFF);
+}
+
+/* the tables of a block coded by the byte before each byte */
+typedef struct hc_context_plan {
+	hc_ulong pairs[UCHAR_MAX + 1][UCHAR_MAX + 1]; /* bytes after each byte */
+	hc_ulong counts[HC_MAX_CONTEXTS][UCHAR_MAX + 1]; /* bytes per cluster */
+	hc_ulong cost[HC_MAX_CONTEXTS][UCHAR_MAX + 1]; /* bits per byte, x256 */
+	hc_encode_entry codes[HC_MAX_CONTEXTS][UCHAR_MAX + 1];
+	hc_byte lengths[HC_MAX_CONTEXTS][HC_LENGTHS_BYTES];
+	size_t lengths_size[HC_MAX_CONTEXTS];
+	hc_byte map[UCHAR_MAX + 1]; /* cluster of each previous byte */
+	unsigned int count;         /* number of clusters           */
+	size_t header;              /* bytes of the map and tables  */
+	hc_ullong bits;             /* bits of coded data           */
+	hc_ullong extra_bits;       /* bits the length limit added  */
+	hc_ulong unique;            /* most codes in one table      */
+	hc_ulong max_code_len;      /* longest code in any table    */
+} hc_context_plan;
+
+/*
+ * Sorts the contexts of a block into at most k clusters whose next
+ * bytes look alike, so that a few tables stand in for one per byte
+ * value. The clusters start out as the most common contexts and are
+ * refined by moving every context to the cluster that codes it in the
+ * fewest bits. Fills in the map and counts of the plan and returns
+ * the number of clusters.
+ */
+static unsigned int hc_cluster_contexts(hc_context_plan* plan, unsigned int k)
+{
+	hc_ullong totals[UCHAR_MAX + 1];
+	hc_ullong cost[HC_MAX_CONTEXTS];
+	hc_byte order[UCHAR_MAX + 1];
+	hc_byte renumber[HC_MAX_CONTEXTS];
+	unsigned int active = 0;
+	unsigned int count = 0;
+	unsigned int iter;
+	unsigned int c;
+	unsigned int s;
+	unsigned int j;
+	int changed = 1;
+
+	/* the contexts that occur, most common first */
+	for (c = 0; c < UCHAR_MAX + 1; c++)
+	{
+		totals[c] = 0;
+		for (s = 0; s < UCHAR_MAX + 1; s++)
+			totals[c] += plan->pairs[c][s];
+
+		plan->map[c] = 0;
+		if (totals[c] == 0)
+			continue;
+
+		for (j = active++; j > 0 && totals[order[j - 1]] < totals[c]; j--)
+			order[j] = order[j - 1];
+		order[j] = (hc_byte)c;
+	}
+
+	if (k > active)
+		k = active;
+
+	for (j = 0; j < k; j++)
+		memcpy(plan->counts[j], plan->pairs[order[j]], sizeof(plan->counts[j]));
+
+	for (iter = 0; iter < 4 && changed; iter++)
+	{
+		/* estimate code lengths, giving unseen bytes half a count */
+		for (j = 0; j < k; j++)
+		{
+			hc_ullong total = 0;
+			hc_ulong base;
+
+			for (s = 0; s < UCHAR_MAX + 1; s++)
+				total += plan->counts[j][s];
+
+			base = hc_log2_fixed(2 * total + UCHAR_MAX + 1);
+			for (s = 0; s < UCHAR_MAX + 1; s++)
+			{
+				plan->cost[j][s] = base
+					- hc_log2_fixed(2 * (hc_ullong)plan->counts[j][s] + 1);
+			}
+		}
+
+		changed = 0;
+		for (c = 0; c < active; c++)
+		{
+			const hc_ulong* row = plan->pairs[order[c]];
+			unsigned int best = 0;
+
+			memset(cost, 0, sizeof(cost));
+			for (s = 0; s < UCHAR_MAX + 1; s++)
+			{
+				if (row[s] == 0)
+					continue;
+				for (j = 0; j < k; j++)
+					cost[j] += (hc_ullong)row[s] * plan->cost[j][s];
+			}
+
+			for (j = 1; j < k; j++)
+			{
+				if (cost[j] < cost[best])
+					best = j;
+			}
+
+			if (iter == 0 || plan->map[order[c]] != best)
+				changed = 1;
+			plan->map[order[c]] = (hc_byte)best;
+		}
+
+		memset(plan->counts, 0, sizeof(plan->counts[0]) * k);
+		for (c = 0; c < active; c++)
+		{
+			for (s = 0; s < UCHAR_MAX + 1; s++)
+				plan->counts[plan->map[order[c]]][s] += plan->pairs[order[c]][s];
+		}
+	}
+
+	/* clusters that lost all their contexts are dropped */
+	for (j = 0; j < k; j++)
+	{
+		for (s = 0; s < UCHAR_MAX + 1 && plan->counts[j][s] == 0; s++)
+			;
+
+		if (s < UCHAR_MAX + 1)
+		{
+			if (count < j)
+				memcpy(plan->counts[count], plan->counts[j],
+					sizeof(plan->counts[j]));
+			renumber[j] = (hc_byte)count++;
+		}
+	}
+
+	for (c = 0; c < active; c++)
+		plan->map[order[c]] = renumber[plan->map[order[c]]];
+
+	return count;
+}
+
+/*
+ * Bits, x256, that each context is charged for every byte value it
+ * sees past the first. Entropy taken from counts falls short of the
+ * real one by about (values - 1) / (2 ln 2) bits over a context, the
+ * Miller-Madow correction, and 1 / (2 ln 2) is 0.72 bits.
+ */
+#define HC_ENTROPY_BIAS 185
+
+/*
+ * The order 0 cost divided by this is what coding by the previous
+ * byte has to save on top of its map. At most HC_MAX_CONTEXTS
+ * clustered tables get only part of the order 1 saving, and a 32nd
+ * kept the plan away from blocks where they lost on the sample files.
+ */
+#define HC_CONTEXT_MARGIN 32
+
+/*
+ * Tells whether coding by the previous byte is worth planning, going
+ * by the entropy of the bytes with and without their contexts. The
+ * saving has to cover the bias of the counts, the context map and a
+ * margin for the clustering.
+ */
+static int hc_contexts_pay(const hc_context_plan* plan)
+{
+	hc_ulong counts[UCHAR_MAX + 1] = { 0 };
+	hc_ullong total = 0;
+	hc_ullong order0 = 0;
+	hc_ullong order1 = 0;
+	hc_ulong c;
+	hc_ulong s;
+
+	for (c = 0; c < UCHAR_MAX + 1; c++)
+	{
+		hc_ullong n = 0;
+		hc_ulong base;
+
+		for (s = 0; s < UCHAR_MAX + 1; s++)
+			n += plan->pairs[c][s];
+
+		if (n == 0)
+			continue;
+
+		base = hc_log2_fixed(n);
+		for (s = 0; s < UCHAR_MAX + 1; s++)
+		{
+			if (plan->pairs[c][s] == 0)
+				continue;
+
+			order1 += (hc_ullong)plan->pairs[c][s]
+				* (base - hc_log2_fixed(plan->pairs[c][s])) + HC_ENTROPY_BIAS;
+			counts[s] += plan->pairs[c][s];
+		}
+
+		total += n;
+		order1 -= HC_ENTROPY_BIAS;
+	}
+
+	for (s = 0; s < UCHAR_MAX + 1; s++)
+	{
+		if (counts[s] > 0)
+			order0 += (hc_ullong)counts[s]
+				* (hc_log2_fixed(total) - hc_log2_fixed(counts[s]));
+	}
+
+	/* the smallest map takes 2 bytes and a nibble per context */
+	return order1 + order0 / HC_CONTEXT_MARGIN
+		+ 256 * CHAR_BIT * (2 + (UCHAR_MAX + 1) / 2) < order0;
+}
+
+/*
+ * Plans the coding of a block with at most k tables picked by the
+ * byte before each byte, building their codes in the arena. Returns
+ * 0 if the block ends up with fewer than two tables.
+ */
+static int hc_plan_contexts(hc_context_plan* plan, const hc_byte* block,
+	size_t size, unsigned int k, hc_ulong max_code_len, hc_arena* arena)
+{
+	hc_sym dict[UCHAR_MAX + 1];
+	hc_ullong extra_bits;
+	hc_ulong unique;
+	hc_ulong i;
+	hc_byte prev = 0;
+	size_t n;
+	unsigned int j;
+
+	/* every block starts out in the context of a zero byte */
+	memset(plan->pairs, 0, sizeof(plan->pairs));
+	for (n = 0; n < size; n++)
+	{
+		plan->pairs[prev][block[n]]++;
+		prev = block[n];
+	}
+
+	if (!hc_contexts_pay(plan))
+		return 0;
+
+	plan->count = hc_cluster_contexts(plan, k);
+
+	if (plan->count < 2)
+		return 0;
+
+	plan->header = 2 + (plan->count <= 16 ? (UCHAR_MAX + 1) / 2 : UCHAR_MAX + 1);
+	plan->bits = 0;
+	plan->extra_bits = 0;
+	plan->unique = 0;
+	plan->max_code_len = 0;
+
+	for (j = 0; j < plan->count; j++)
+	{
+		unique = hc_build_codes(plan->counts[j], max_code_len, arena, dict,
+			&extra_bits);
+
+		/* the arena is reset for the next table, so pack this one now */
+		hc_create_encode_table(dict, unique, plan->codes[j]);
+		plan->lengths_size[j] = hc_pack_lengths(dict, unique, plan->lengths[j]);
+		plan->header += plan->lengths_size[j];
+		plan->extra_bits += extra_bits;
+
+		if (unique > plan->unique)
+			plan->unique = unique;
+
+		for (i = 0; i < unique; i++)
+		{
+			plan->bits += (hc_ullong)dict[i].f * dict[i].code->bit_count;
+			if (dict[i].code->bit_count > plan->max_code_len)
+				plan->max_code_len = dict[i].code->bit_count;
+		}
+	}
+
+	return 1;
+}
+
+/* writes the map, tables and data of a block planned in contexts */
+static void hc_write_context_block(hc_writer* out, const hc_byte* block,
+	size_t size, const hc_context_plan* plan)
+{
+	hc_bitwriter bw;
+	hc_byte prev = 0;
+	size_t n;
+	unsigned int j;
+
+	hc_write_byte(out, block_contexts);
+	hc_write_byte(out, (hc_byte)plan->count);
+
+	/* the cluster of every previous byte, two to a byte if they fit */
+	if (plan->count <= 16)
+	{
+		for (j = 0; j < UCHAR_MAX + 1; j += 2)
+			hc_write_byte(out, (hc_byte)(plan->map[j] | plan->map[j + 1] << 4));
+	}
+	else
+	{
+		hc_write(out, plan->map, sizeof(plan->map));
+	}
+
+	for (j = 0; j < plan->count; j++)
+		hc_write(out, plan->lengths[j], plan->lengths_size[j]);
+
+	hc_write_u32(out, (hc_ulong)plan->bits);
+
+	bw.out = out;
+	bw.acc = 0;
+	bw.count = 0;
+
+	for (n = 0; n < size; n++)
+	{
+		const hc_encode_entry* e = &plan->codes[plan->map[prev]][block[n]];
+
+		if (e->len <= 32)
+		{
+			hc_put_bits(&bw, e->code, e->len);
+		}
+		else
+		{
+			hc_put_bits(&bw, e->code & 0xFFFFFFFF, 32);
+			hc_put_bits(&bw, e->code >> 32, e->len - 32);
+		}
+
+		prev = block[n];
+	}
+
+	hc_flush_bits(&bw);
+	hc_write_byte(out, data_end);
+}
+
+/*
+ * Memory a block is coded in, kept from one block to the next by
+ * whoever codes them. The plan and its arena are made the first time
+ * a block is planned in contexts.
+ */
+typedef struct hc_encode_scratch {
+	hc_arena* arena;       /* the tree of the block's own table    */
+	hc_arena* plan_arena;  /* the trees of its context tables      */
+	hc_context_plan* plan;
+} hc_encode_scratch;
+
+static void hc_init_scratch(hc_encode_scratch* scratch)
+{
+	scratch->arena = hc_create_arena();
+	scratch->plan_arena = NULL;
+	scratch->plan = NULL;
+}
+
+static void hc_free_scratch(hc_encode_scratch* scratch)
+{
+	hc_destroy_arena(scratch->arena);
+	hc_destroy_arena(scratch->plan_arena);
+	free(scratch->plan);
+}
+
+/*
+ * Builds a table for one block of input and writes the block,
+ * its table and its encoded data to the output. The trees are built
+ * in the scratch memory. Returns the number of bits the code length
+ * limit of the options added to the block.
+ */
+static hc_ullong hc_encode_block(hc_writer* out, const hc_byte* block,
+	size_t size, const hc_options* opts, hc_encode_scratch* scratch)
+{
+	hc_ullong extra_bits;
+	hc_ulong unique;
+	hc_sym dict[UCHAR_MAX + 1];
+	hc_ulong counts[UCHAR_MAX + 1];
+	hc_stats* stats = opts->stats;
+	hc_timer timer;
+	hc_byte lengths[HC_LENGTHS_BYTES];
+	size_t header;
+	hc_ullong bits = 0;
+	hc_ullong coded;
+	hc_ulong last = 0;
+	hc_ulong i;
+
+	if (stats != NULL)
+		hc_start_timer(&timer, stats);
+
+	/* count the bytes in the block */
+	hc_histogram(block, size, counts);
+
+	for (i = 0, unique = 0; i < UCHAR_MAX + 1; i++)
+	{
+		if (counts[i] > 0)
+		{
+			unique++;
+			last = i;
+		}
+	}
+
+	if (stats != NULL)
+		hc_lap(&timer, &stats->histogram_time);
+
+	hc_write_byte(out, block_begin);
+	hc_write_u32(out, (hc_ulong)size);
+
+	/*
+	 * a run of one byte value needs only that byte, which no other
+	 * coding can undercut, so nothing else needs sizing
+	 */
+	if (unique == 1)
+	{
+		hc_write_byte(out, block_rle);
+		hc_write_byte(out, (hc_byte)last);
+
+		if (stats != NULL)
+		{
+			hc_lap(&timer, &stats->code_time);
+			if (stats->unique < 1)
+				stats->unique = 1;
+			stats->blocks++;
+			stats->symbols += size;
+		}
+
+		return 0;
+	}
+
+	unique = hc_build_codes(counts, opts->max_code_len, scratch->arena,
+		dict, &extra_bits);
+
+	if (stats != NULL)
+		hc_lap(&timer, &stats->tree_time);
+
+	/* weigh the coded size up against the block itself */
+	header = hc_pack_lengths(dict, unique, lengths);
+	for (i = 0; i < unique; i++)
+		bits += (hc_ullong)dict[i].f * dict[i].code->bit_count;
+
+	if (opts->streams == HC_STREAMS)
+		coded = 1 + 4 * HC_STREAMS + (bits + CHAR_BIT - 1) / CHAR_BIT
+			+ HC_STREAMS + 1;
+	else
+		coded = 2 + 2 * sizeof(hc_ulong) + (bits + CHAR_BIT - 1) / CHAR_BIT + 1;
+
+	/*
+	 * tables by the previous byte pay off if they save more than they
+	 * add, which they can on blocks too flat for one table to code
+	 */
+	if (opts->contexts > 1 && opts->streams != HC_STREAMS)
+	{
+		hc_context_plan* plan;
+		unsigned int k = opts->contexts < HC_MAX_CONTEXTS
+			? opts->contexts : HC_MAX_CONTEXTS;
+		int used = 0;
+
+		/* the block's own codes stay in its arena in case it loses */
+		if (scratch->plan == NULL)
+		{
+			scratch->plan = (hc_context_plan*)hc_malloc(sizeof(hc_context_plan));
+			scratch->plan_arena = hc_create_arena();
+		}
+		plan = scratch->plan;
+
+		/* the smallest of the context tables, one table and the block wins */
+		if (hc_plan_contexts(plan, block, size, k, opts->max_code_len,
+			scratch->plan_arena))
+		{
+			hc_ullong planned = plan->header + 5
+				+ (plan->bits + CHAR_BIT - 1) / CHAR_BIT;
+
+			used = planned < header + coded && planned < 1 + (hc_ullong)size;
+		}
+
+		if (stats != NULL)
+			hc_lap(&timer, &stats->tree_time);
+
+		if (used)
+		{
+			hc_write_context_block(out, block, size, plan);
+			extra_bits = plan->extra_bits;
+
+			if (stats != NULL)
+			{
+				hc_lap(&timer, &stats->code_time);
+				if (plan->unique > stats->unique)
+					stats->unique = plan->unique;
+				if (plan->max_code_len > stats->max_code_len)
+					stats->max_code_len = plan->max_code_len;
+				stats->header_bytes += plan->header;
+				stats->blocks++;
+				stats->symbols += size;
+				stats->code_bits += plan->bits;
+			}
+		}
+
+		if (used)
+			return extra_bits;
+	}
+
+	/* store the block if no coding comes out smaller */
+	if (header + coded >= 1 + (hc_ullong)size)
+	{
+		hc_write_byte(out, block_stored);
+		hc_write(out, block, size);
+
+		if (stats != NULL)
+		{
+			hc_lap(&timer, &stats->code_time);
+			if (unique > stats->unique)
+				stats->unique = unique;
+			stats->blocks++;
+			stats->symbols += size;
+			stats->code_bits += (hc_ullong)size * CHAR_BIT;
+		}
+
+		return 0;
+	}
+
+	/* write the code lengths to the output stream */
+	hc_write(out, lengths, header);
+
+	if (stats != NULL)
+	{
+		hc_lap(&timer, &stats->table_time);
+		stats->header_bytes += header;
+	}
+
+	/* encode the block straight to the output stream */
+	if (opts->streams == HC_STREAMS)
+		hc_encode_streams(out, block, size, dict, unique);
+	else
+		hc_encode_data(out, block, size, dict, unique);
+
+	if (opts->sync_interval > 0 && opts->streams != HC_STREAMS)
+		hc_write_sync_points(out, block, size, dict, unique,
+			opts->sync_interval);
+
+	if (stats != NULL)
+	{
+		hc_lap(&timer, &stats->code_time);
+		hc_table_stats(stats, dict, unique);
+		stats->blocks++;
+		stats->symbols += size;
+		stats->code_bits += bits;
+	}
+
+	return extra_bits;
+}
+
+/* the blocks written so far, kept for the index at the end */
+typedef struct hc_index {
+	hc_block_info* blocks;
+	hc_ulong count;
+	hc_ulong cap;
+} hc_index;
+
+/* grows an index of blocks by one entry */
+static void hc_add_block_info(hc_index* index, hc_ullong offset,
+	hc_ullong end, size_t raw_size)
+{
+	if (index->count == index->cap)
+	{
+		index->cap = index->cap > 0 ? index->cap * 2 : 64;
+		index->blocks = (hc_block_info*)hc_realloc(index->blocks,
+			sizeof(hc_block_info) * index->cap);
+	}
+
+	index->blocks[index->count].offset = offset;
+	index->blocks[index->count].size = (hc_ulong)(end - offset);
+	index->blocks[index->count].raw_size = (hc_ulong)raw_size;
+	index->count++;
+}
+
+/* writes the block index that follows the end of a stream */
+static void hc_write_index(hc_writer* out, hc_index* index)
+{
+	hc_ullong index_pos = out->flushed + out->len;
+	hc_ulong i;
+
+	hc_write_byte(out, index_begin);
+
+	for (i = 0; i < index->count; i++)
+	{
+		hc_write_u64(out, index->blocks[i].offset);
+		hc_write_u32(out, index->blocks[i].size);
+		hc_write_u32(out, index->blocks[i].raw_size);
+	}
+
+	hc_write_u32(out, index->count);
+	hc_write_u64(out, index_pos);
+	hc_write(out, index_magic, sizeof(index_magic));
+}
+
+static long long hc_tell(FILE* stream)
+{
+#ifdef _WIN32
+	return _ftelli64(stream);
+#else
+	return (long long)ftello(stream);
+#endif
+}
+
+static int hc_seek(FILE* stream, long long pos, int origin)
+{
+#ifdef _WIN32
+	return _fseeki64(stream, pos, origin) == 0;
+#else
+	return fseeko(stream, (off_t)pos, origin) == 0;
+#endif
+}
+
+/* a whole file mapped into memory */
+typedef struct hc_mapping {
+	hc_byte* data;
+	size_t size;
+#ifdef _WIN32
+	HANDLE handle;
+#endif
+} hc_mapping;
+
+/*
+ * Maps a regular file into memory. With a size of 0 the file is mapped
+ * read only as it is; otherwise it is resized to size bytes and mapped
+ * for writing. Returns 0 if the file cannot be mapped.
+ */
+static int hc_map_file(FILE* stream, hc_mapping* map, hc_ullong size)
+{
+#ifdef _WIN32
+	HANDLE file = (HANDLE)_get_osfhandle(_fileno(stream));
+	int writable = size > 0;
+	LARGE_INTEGER file_size;
+
+	if (file == INVALID_HANDLE_VALUE || GetFileType(file) != FILE_TYPE_DISK)
+		return 0;
+
+	if (size == 0)
+	{
+		if (!GetFileSizeEx(file, &file_size))
+			return 0;
+		size = (hc_ullong)file_size.QuadPart;
+	}
+
+	if (size == 0 || size > (size_t)-1)
+		return 0;
+
+	/* a mapping larger than the file extends it */
+	map->handle = CreateFileMapping(file, NULL,
+		writable ? PAGE_READWRITE : PAGE_READONLY,
+		(DWORD)(size >> 32), (DWORD)size, NULL);
+	if (map->handle == NULL)
+		return 0;
+
+	map->data = (hc_byte*)MapViewOfFile(map->handle,
+		writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, (SIZE_T)size);
+	if (map->data == NULL)
+	{
+		CloseHandle(map->handle);
+		return 0;
+	}
+#else
+	int fd = fileno(stream);
+	int writable = size > 0;
+	struct stat st;
+	void* data;
+
+	if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+		return 0;
+
+	if (!writable)
+		size = (hc_ullong)st.st_size;
+	else if (ftruncate(fd, (off_t)size) != 0)
+		return 0;
+
+	if (size == 0 || size > (size_t)-1)
+		return 0;
+
+	data = mmap(NULL, (size_t)size,
+		writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED)
+		return 0;
+
+	/* blocks are read and written front to back */
+	madvise(data, (size_t)size, MADV_SEQUENTIAL);
+
+	map->data = (hc_byte*)data;
+#endif
+
+	map->size = (size_t)size;
+
+	return 1;
+}
+
+/* unmaps a file, returning 0 if changes could not be written back */
+static int hc_unmap_file(hc_mapping* map)
+{
+#ifdef _WIN32
+	int ok = FlushViewOfFile(map->data, 0) != 0;
+
+	UnmapViewOfFile(map->data);
+	CloseHandle(map->handle);
+
+	return ok;
+#else
+	return munmap(map->data, map->size) == 0;
+#endif
+}
+
+/*
+ * Works out from the trailer at the end of a file where its index
+ * starts and where the stream it indexes starts. Returns 0 if the
+ * trailer is not valid or the index lies before the given position.
+ */
+static int hc_locate_index(const hc_byte* trailer, long long end,
+	long long here, hc_ulong* count, long long* index_pos, long long* base)
+{
+	if (memcmp(trailer + 12, index_magic, sizeof(index_magic)) != 0)
+		return 0;
+
+	*count = hc_get_u32(trailer);
+
+	/* the index sits right before the trailer */
+	*index_pos = end - 16 - (long long)*count * 16 - 1;
+	*base = *index_pos - (long long)hc_get_u64(trailer + 4);
+
+	return *index_pos >= here && *base >= 0;
+}
+
+/* decodes an index entry of a stream that starts at base */
+static void hc_get_block_info(const hc_byte* entry, long long base,
+	hc_block_info* info)
+{
+	info->offset = (hc_ullong)base + hc_get_u64(entry);
+	info->size = hc_get_u32(entry + 8);
+	info->raw_size = hc_get_u32(entry + 12);
+}
+
+/*
+ * Reads the block index of an encoded file held in memory. Returns
+ * NULL if there is none.
+ */
+static hc_block_info* hc_parse_index(const hc_byte* data, size_t size,
+	hc_ulong* count)
+{
+	hc_block_info* blocks;
+	long long index_pos;
+	long long base;
+	hc_ulong i;
+
+	*count = 0;
+
+	if (size < 16 || !hc_locate_index(data + size - 16, (long long)size, 0,
+		count, &index_pos, &base) || data[index_pos] != index_begin)
+	{
+		*count = 0;
+		return NULL;
+	}
+
+	blocks = (hc_block_info*)hc_malloc(sizeof(hc_block_info) * (*count + 1));
+
+	for (i = 0; i < *count; i++)
+		hc_get_block_info(data + index_pos + 1 + i * 16, base, &blocks[i]);
+
+	return blocks;
+}
+
+hc_block_info* hc_read_index(FILE* stream, hc_ulong* count)
+{
+	hc_byte trailer[16];
+	hc_byte entry[16];
+	hc_block_info* blocks = NULL;
+	long long here = hc_tell(stream);
+	long long end;
+	long long index_pos;
+	long long base;
+	hc_ulong i;
+
+	*count = 0;
+
+	if (here < 0 || !hc_seek(stream, 0, SEEK_END))
+		return NULL;
+
+	end = hc_tell(stream);
+
+	if (end - here < (long long)sizeof(trailer)
+		|| !hc_seek(stream, end - (long long)sizeof(trailer), SEEK_SET)
+		|| fread(trailer, 1, sizeof(trailer), stream) != sizeof(trailer)
+		|| !hc_locate_index(trailer, end, here, count, &index_pos, &base)
+		|| !hc_seek(stream, index_pos, SEEK_SET)
+		|| fgetc(stream) != index_begin)
+	{
+		*count = 0;
+		hc_seek(stream, here, SEEK_SET);
+		return NULL;
+	}
+
+	blocks = (hc_block_info*)hc_malloc(sizeof(hc_block_info) * (*count + 1));
+
+	for (i = 0; i < *count; i++)
+	{
+		if (fread(entry, 1, sizeof(entry), stream) != sizeof(entry))
+		{
+			free(blocks);
+			*count = 0;
+			hc_seek(stream, here, SEEK_SET);
+			return NULL;
+		}
+
+		hc_get_block_info(entry, base, &blocks[i]);
+	}
+
+	hc_seek(stream, here, SEEK_SET);
+
+	return blocks;
+}
+
+void hc_init_options(hc_options* opts)
+{
+	opts->threads = 1;
+	opts->block_size = HC_BLOCK_SIZE;
+	opts->streams = 1;
+	opts->max_code_len = HC_DECODE_MAX_BITS;
+	opts->limit_cost = NULL;
+	opts->map = 0;
+	opts->adaptive = 0;
+	opts->live = 0;
+	opts->stats = NULL;
+	opts->sync_interval = 0;
+	opts->contexts = 1;
+}
+
+/* a unit of work that runs on its own thread */
+typedef struct hc_task {
+	void (*fn)(void*);
+	void* arg;
+	hc_thread thread;
+	int started;
+} hc_task;
+
+#ifdef _WIN32
+static unsigned __stdcall hc_task_entry(void* arg)
+{
+	hc_task* task = (hc_task*)arg;
+	task->fn(task->arg);
+	return 0;
+}
+#else
+static void* hc_task_entry(void* arg)
+{
+	hc_task* task = (hc_task*)arg;
+	task->fn(task->arg);
+	return NULL;
+}
+#endif
+
+/* starts a task, running it right away if no thread can be created */
+static void hc_start_task(hc_task* task, void (*fn)(void*), void* arg)
+{
+	task->fn = fn;
+	task->arg = arg;
+
+#ifdef _WIN32
+	task->thread = (HANDLE)_beginthreadex(NULL, 0, hc_task_entry, task, 0, NULL);
+	task->started = task->thread != 0;
+#else
+	task->started = pthread_create(&task->thread, NULL, hc_task_entry, task) == 0;
+#endif
+
+	if (!task->started)
+		fn(arg);
+}
+
+static void hc_join_task(hc_task* task)
+{
+	if (!task->started)
+		return;
+
+#ifdef _WIN32
+	WaitForSingleObject(task->thread, INFINITE);
+	CloseHandle(task->thread);
+#else
+	pthread_join(task->thread, NULL);
+#endif
+
+	task->started = 0;
+}
+
+/* one block of input and the memory its encoded form is written to */
+typedef struct hc_encode_job {
+	hc_byte* data;
+	const hc_byte* block; /* the input, in data or in a memory reader */
+	size_t size;
+	hc_writer* out;
+	hc_ullong extra_bits; /* bits added by the code length limit */
+} hc_encode_job;
+
+/* the share of a batch of jobs taken on by one worker */
+typedef struct hc_encode_worker {
+	hc_task task;
+	hc_options opts;     /* the call's options, with stats of its own */
+	hc_stats stats;
+	hc_encode_scratch scratch;
+	hc_encode_job* jobs;
+	size_t count;
+	size_t first;
+	size_t step;
+} hc_encode_worker;
+
+static void hc_run_encode_worker(void* arg)
+{
+	hc_encode_worker* worker = (hc_encode_worker*)arg;
+	size_t i;
+
+	for (i = worker->first; i < worker->count; i += worker->step)
+	{
+		hc_encode_job* job = &(worker->jobs[i]);
+
+		job->out->len = 0;
+		job->extra_bits = hc_encode_block(job->out, job->block, job->size,
+			&worker->opts, &worker->scratch);
+	}
+}
+
+/*
+ * Reads up to size bytes of input and points block at them. Memory
+ * readers give out their own bytes, others copy them into buf.
+ */
+static size_t hc_read_block(hc_reader* in, hc_byte* buf, size_t size,
+	const hc_byte** block)
+{
+	if (in->stream == NULL)
+	{
+		if (size > in->len - in->pos)
+			size = in->len - in->pos;
+
+		*block = in->buf + in->pos;
+		in->pos += size;
+
+		return size;
+	}
+
+	*block = buf;
+
+	return hc_read(in, buf, size);
+}
+
+/* fills a batch of jobs with input blocks, returning how many were read */
+static size_t hc_read_batch(hc_reader* in, hc_encode_job* jobs,
+	size_t count, size_t block_size)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++)
+	{
+		jobs[i].size = hc_read_block(in, jobs[i].data, block_size,
+			&(jobs[i].block));
+
+		if (jobs[i].size == 0)
+			break;
+
+		if (jobs[i].size < block_size)
+			return i + 1;
+	}
+
+	return i;
+}
+
+/* writes encoded blocks out in order */
+static void hc_write_batch(hc_writer* out, hc_index* index,
+	hc_encode_job* jobs, size_t count, hc_ullong* extra_bits)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++)
+	{
+		hc_ullong offset = out->flushed + out->len;
+
+		hc_write(out, jobs[i].out->buf, jobs[i].out->len);
+		hc_add_block_info(index, offset, offset + jobs[i].out->len,
+			jobs[i].size);
+		*extra_bits += jobs[i].extra_bits;
+	}
+}
+
+/*
+ * Encodes the blocks of a batch on several threads while the next
+ * batch is read, then writes the encoded blocks out in order.
+ */
+static void hc_encode_parallel(hc_reader* in, hc_writer* out,
+	hc_index* index, size_t block_size, const hc_options* opts,
+	hc_ullong* extra_bits)
+{
+	unsigned int threads = opts->threads;
+	size_t batch = (size_t)threads * 2;
+	hc_encode_job* jobs[2];
+	size_t counts[2];
+	hc_encode_worker* workers;
+	size_t i;
+	int cur = 0;
+	int prev = -1;
+
+	workers = (hc_encode_worker*)hc_malloc(sizeof(hc_encode_worker) * threads);
+	for (i = 0; i < threads; i++)
+	{
+		hc_init_scratch(&workers[i].scratch);
+		workers[i].opts = *opts;
+		workers[i].opts.stats = opts->stats != NULL ? &workers[i].stats : NULL;
+		memset(&workers[i].stats, 0, sizeof(hc_stats));
+	}
+
+	for (cur = 0; cur < 2; cur++)
+	{
+		jobs[cur] = (hc_encode_job*)hc_malloc(sizeof(hc_encode_job) * batch);
+		for (i = 0; i < batch; i++)
+		{
+			/* memory readers hand out their own bytes */
+			jobs[cur][i].data = in->stream != NULL
+				? (hc_byte*)hc_malloc(block_size) : NULL;
+			jobs[cur][i].size = 0;
+			jobs[cur][i].out = hc_create_memory_writer(block_size);
+		}
+	}
+
+	cur = 0;
+	counts[cur] = hc_read_batch(in, jobs[cur], batch, block_size);
+
+	while (counts[cur] > 0)
+	{
+		int next = 1 - cur;
+
+		for (i = 0; i < threads; i++)
+		{
+			workers[i].jobs = jobs[cur];
+			workers[i].count = counts[cur];
+			workers[i].first = i;
+			workers[i].step = threads;
+			hc_start_task(&(workers[i].task), hc_run_encode_worker, &workers[i]);
+		}
+
+		/* write the previous batch and read the next one meanwhile */
+		if (prev >= 0)
+			hc_write_batch(out, index, jobs[prev], counts[prev], extra_bits);
+
+		/* the last short block marks the end of the input */
+		if (counts[cur] == batch && jobs[cur][batch - 1].size == block_size)
+			counts[next] = hc_read_batch(in, jobs[next], batch, block_size);
+		else
+			counts[next] = 0;
+
+		for (i = 0; i < threads; i++)
+			hc_join_task(&(workers[i].task));
+
+		prev = cur;
+		cur = next;
+	}
+
+	if (prev >= 0)
+		hc_write_batch(out, index, jobs[prev], counts[prev], extra_bits);
+
+	for (cur = 0; cur < 2; cur++)
+	{
+		for (i = 0; i < batch; i++)
+		{
+			free(jobs[cur][i].data);
+			hc_destroy_writer(jobs[cur][i].out);
+		}
+		free(jobs[cur]);
+	}
+
+	for (i = 0; i < threads; i++)
+	{
+		if (opts->stats != NULL)
+			hc_add_stats(opts->stats, &workers[i].stats);
+		hc_free_scratch(&workers[i].scratch);
+	}
+	free(workers);
+}
+
+/*
+ * Escapes sent after the code of the NYT leaf, as HC_ADAPTIVE_ESCAPE_BITS
+ * raw bits. Values below UCHAR_MAX + 1 introduce a byte not seen yet.
+ */
+#define HC_ADAPTIVE_ESCAPE_BITS (CHAR_BIT + 1)
+#define HC_ADAPTIVE_FLUSH (UCHAR_MAX + 1)
+#define HC_ADAPTIVE_END (UCHAR_MAX + 2)
+
+/* leaves for every byte value plus the NYT leaf, and their parents */
+#define HC_ADAPTIVE_NODES (2 * (UCHAR_MAX + 2) - 1)
+
+/* total weight at which both sides start over with an empty tree */
+#define HC_ADAPTIVE_MAX_WEIGHT 0x40000000UL
+
+/*
+ * Adaptive Huffman tree (FGK), updated after every symbol by encoder
+ * and decoder alike. The nodes are kept in an array in sibling order:
+ * the root comes first, weights never increase along the array and
+ * siblings are neighbours, so a node's block leader is found by
+ * scanning back a few entries. Nodes use sym.f for their weight,
+ * sym.b for their byte, leaf_1 and leaf_2 for the 1 and 0 children, as
+ * in hc_reconstruct_tree, and prev for their parent.
+ */
+typedef struct hc_adaptive {
+	hc_node nodes[HC_ADAPTIVE_NODES];
+	hc_node* leaves[UCHAR_MAX + 1]; /* leaf of each byte, NULL if unseen */
+	hc_node* nyt;                   /* leaf standing for unseen bytes     */
+	hc_ulong count;                 /* nodes in use                       */
+} hc_adaptive;
+
+/* starts over with a tree holding only the NYT leaf */
+static void hc_reset_adaptive(hc_adaptive* model)
+{
+	hc_node* root = &model->nodes[0];
+	hc_ulong i;
+
+	for (i = 0; i < UCHAR_MAX + 1; i++)
+		model->leaves[i] = NULL;
+
+	root->sym.b = 0;
+	root->sym.f = 0;
+	root->leaf_1 = NULL;
+	root->leaf_2 = NULL;
+	root->prev = NULL;
+	root->next = NULL;
+
+	model->nyt = root;
+	model->count = 1;
+}
+
+/* points the children or the leaf entry of a node back at it */
+static void hc_relink_adaptive(hc_adaptive* model, hc_node* node)
+{
+	if (node->leaf_1 != NULL)
+	{
+		node->leaf_1->prev = node;
+		node->leaf_2->prev = node;
+	}
+	else if (node != model->nyt)
+	{
+		model->leaves[node->sym.b] = node;
+	}
+}
+
+/* swaps the subtrees held by two nodes, which keep their places */
+static void hc_swap_adaptive(hc_adaptive* model, hc_node* a, hc_node* b)
+{
+	hc_node t = *a;
+
+	a->sym = b->sym;
+	a->leaf_1 = b->leaf_1;
+	a->leaf_2 = b->leaf_2;
+	b->sym = t.sym;
+	b->leaf_1 = t.leaf_1;
+	b->leaf_2 = t.leaf_2;
+
+	if (model->nyt == a)
+		model->nyt = b;
+	else if (model->nyt == b)
+		model->nyt = a;
+
+	hc_relink_adaptive(model, a);
+	hc_relink_adaptive(model, b);
+}
+
+/* counts one more occurrence of a byte, adding it to the tree if new */
+static void hc_update_adaptive(hc_adaptive* model, hc_byte b)
+{
+	hc_node* node = model->leaves[b];
+
+	if (node == NULL)
+	{
+		/* the NYT leaf becomes the parent of the new leaf and itself */
+		hc_node* parent = model->nyt;
+		hc_node* leaf = &model->nodes[model->count];
+		hc_node* nyt = &model->nodes[model->count + 1];
+
+		leaf->sym.b = b;
+		leaf->sym.f = 0;
+		leaf->leaf_1 = NULL;
+		leaf->leaf_2 = NULL;
+		leaf->prev = parent;
+		leaf->next = NULL;
+		*nyt = *leaf;
+		nyt->sym.b = 0;
+
+		parent->leaf_2 = nyt;
+		parent->leaf_1 = leaf;
+
+		model->leaves[b] = leaf;
+		model->nyt = nyt;
+		model->count += 2;
+		node = leaf;
+	}
+
+	while (node != NULL)
+	{
+		hc_node* leader = node;
+
+		/* move the node to the front of its block, past equal weights */
+		while (leader > model->nodes && leader[-1].sym.f == node->sym.f)
+			leader--;
+
+		if (leader != node && leader != node->prev)
+		{
+			hc_swap_adaptive(model, node, leader);
+			node = leader;
+		}
+
+		node->sym.f++;
+		node = node->prev;
+	}
+
+	if (model->nodes[0].sym.f >= HC_ADAPTIVE_MAX_WEIGHT)
+		hc_reset_adaptive(model);
+}
+
+/* writes the code of a node, from the root down */
+static void hc_put_adaptive(hc_bitwriter* bw, const hc_node* node)
+{
+	hc_byte path[HC_ADAPTIVE_NODES];
+	hc_ulong depth = 0;
+
+	for (; node->prev != NULL; node = node->prev)
+		path[depth++] = node == node->prev->leaf_1;
+
+	while (depth > 0)
+	{
+		hc_ulong bits = 0;
+		unsigned int n = 0;
+
+		while (depth > 0 && n < 32)
+			bits |= (hc_ulong)path[--depth] << n++;
+
+		hc_put_bits(bw, bits, n);
+	}
+}
+
+/* writes the NYT code and an escape, byte aligning after a flush */
+static void hc_put_escape(hc_bitwriter* bw, const hc_adaptive* model,
+	hc_ulong escape)
+{
+	hc_put_adaptive(bw, model->nyt);
+	hc_put_bits(bw, escape, HC_ADAPTIVE_ESCAPE_BITS);
+
+	if (escape >= HC_ADAPTIVE_FLUSH)
+		hc_flush_bits(bw);
+}
+
+/*
+ * Encodes a reader with an adaptive tree, without tables or blocks.
+ * Input is coded as it arrives and ends with a flush escape that pads
+ * the output to whole bytes, so a live stream can pass it on at once.
+ */
+static void hc_encode_adaptive(hc_reader* in, hc_writer* out,
+	const hc_options* opts)
+{
+	hc_adaptive* model = (hc_adaptive*)hc_malloc(sizeof(hc_adaptive));
+	hc_bitwriter bw;
+	size_t avail;
+	size_t i;
+
+	bw.out = out;
+	bw.acc = 0;
+	bw.count = 0;
+
+	hc_reset_adaptive(model);
+	hc_write_byte(out, adaptive_begin);
+
+	while ((avail = hc_fill_reader(in)) > 0)
+	{
+		const hc_byte* data = in->buf + in->pos;
+
+		for (i = 0; i < avail; i++)
+		{
+			hc_node* leaf = model->leaves[data[i]];
+
+			if (leaf != NULL)
+				hc_put_adaptive(&bw, leaf);
+			else
+				hc_put_escape(&bw, model, data[i]);
+
+			hc_update_adaptive(model, data[i]);
+		}
+
+		in->pos += avail;
+		hc_put_escape(&bw, model, HC_ADAPTIVE_FLUSH);
+
+		if (opts->live && out->stream != NULL)
+		{
+			hc_flush_writer(out);
+			fflush(out->stream);
+		}
+	}
+
+	hc_put_escape(&bw, model, HC_ADAPTIVE_END);
+	free(model);
+
+	if (opts->limit_cost != NULL)
+		*opts->limit_cost = 0;
+}
+
+/* bits of a live stream, taken from a reader one byte at a time */
+typedef struct hc_bitinput {
+	hc_reader* in;
+	hc_ulong acc;
+	unsigned int count;
+} hc_bitinput;
+
+/* reads n bits, first bit lowest, returning 0 at the end of the input */
+static int hc_get_bits(hc_bitinput* bi, unsigned int n, hc_ulong* bits)
+{
+	unsigned int i;
+
+	*bits = 0;
+
+	for (i = 0; i < n; i++)
+	{
+		if (bi->count == 0)
+		{
+			int b = hc_read_byte(bi->in);
+
+			if (b == EOF)
+				return 0;
+
+			bi->acc = (hc_ulong)b;
+			bi->count = CHAR_BIT;
+		}
+
+		*bits |= (bi->acc & 1) << i;
+		bi->acc >>= 1;
+		bi->count--;
+	}
+
+	return 1;
+}
+
+/* decodes a stream written by hc_encode_adaptive */
+static int hc_decode_adaptive(hc_reader* in, hc_writer* out)
+{
+	hc_adaptive* model = (hc_adaptive*)hc_malloc(sizeof(hc_adaptive));
+	hc_bitinput bi;
+	hc_ulong bits;
+	int ok = 1;
+
+	bi.in = in;
+	bi.acc = 0;
+	bi.count = 0;
+
+	hc_reset_adaptive(model);
+
+	while (ok)
+	{
+		hc_node* node = &model->nodes[0];
+
+		while (ok && node->leaf_1 != NULL)
+		{
+			ok = hc_get_bits(&bi, 1, &bits);
+			node = bits ? node->leaf_1 : node->leaf_2;
+		}
+
+		if (!ok)
+			break;
+
+		if (node == model->nyt)
+		{
+			if (!hc_get_bits(&bi, HC_ADAPTIVE_ESCAPE_BITS, &bits)
+				|| bits > HC_ADAPTIVE_END)
+			{
+				ok = 0;
+				break;
+			}
+
+			if (bits == HC_ADAPTIVE_END)
+				break;
+
+			/* pass on what the encoder had at hand when it flushed */
+			if (bits == HC_ADAPTIVE_FLUSH)
+			{
+				bi.count = 0;
+				if (out->stream != NULL)
+				{
+					hc_flush_writer(out);
+					fflush(out->stream);
+				}
+				continue;
+			}
+		}
+		else
+		{
+			bits = node->sym.b;
+		}
+
+		hc_write_byte(out, (hc_byte)bits);
+		hc_update_adaptive(model, (hc_byte)bits);
+	}
+
+	free(model);
+
+	return ok;
+}
+
+int hc_encode_file(FILE *in_stream, FILE *out_stream)
+{
+	hc_options opts;
+
+	hc_init_options(&opts);
+
+	return hc_encode_file_ex(in_stream, out_stream, &opts);
+}
+
+/*
+ * Encodes everything a reader holds as a stream of blocks followed by
+ * the block index.
+ */
+static void hc_encode_stream(hc_reader* in, hc_writer* out,
+	const hc_options* opts)
+{
+	hc_byte* buf;
+	const hc_byte* block;
+	hc_encode_scratch scratch;
+	hc_index index;
+	size_t size;
+	size_t block_size = opts->block_size;
+	hc_ullong extra_bits = 0;
+
+	if (block_size == 0)
+		block_size = HC_BLOCK_SIZE;
+	if (block_size > HC_MAX_BLOCK_SIZE)
+		block_size = HC_MAX_BLOCK_SIZE;
+
+	if (opts->adaptive)
+	{
+		hc_encode_adaptive(in, out, opts);
+		return;
+	}
+
+	index.blocks = NULL;
+	index.count = 0;
+	index.cap = 0;
+
+	hc_write_byte(out, stream_begin);
+
+	if (opts->threads > 1)
+	{
+		hc_encode_parallel(in, out, &index, block_size, opts, &extra_bits);
+	}
+	else
+	{
+		buf = in->stream == NULL ? NULL : (hc_byte*)hc_malloc(block_size);
+		hc_init_scratch(&scratch);
+
+		/* encode the input one block at a time in a single pass */
+		while ((size = hc_read_block(in, buf, block_size, &block)) > 0)
+		{
+			hc_ullong offset = out->flushed + out->len;
+
+			extra_bits += hc_encode_block(out, block, size, opts, &scratch);
+			hc_add_block_info(&index, offset, out->flushed + out->len, size);
+		}
+
+		hc_free_scratch(&scratch);
+		free(buf);
+	}
+
+	hc_write_byte(out, stream_end);
+
+	/* the index lets decoders find every block without parsing */
+	hc_write_index(out, &index);
+	free(index.blocks);
+
+	if (opts->limit_cost != NULL)
+		*opts->limit_cost = (extra_bits + CHAR_BIT - 1) / CHAR_BIT;
+}
+
+int hc_encode_file_ex(FILE *in_stream, FILE *out_stream,
+	const hc_options* opts)
+{
+	hc_reader* in;
+	hc_writer* out;
+	hc_mapping map;
+	long long start = -1;
+	int mapped = 0;
+
+	/* blocks of a mapped file are encoded where they lie */
+	if (opts->map)
+	{
+		start = hc_tell(in_stream);
+		mapped = start >= 0 && hc_map_file(in_stream, &map, 0);
+
+		if (mapped && (size_t)start > map.size)
+		{
+			hc_unmap_file(&map);
+			mapped = 0;
+		}
+	}
+
+	if (opts->stats != NULL)
+		hc_begin_stats(opts->stats);
+
+	if (mapped)
+		in = hc_create_memory_reader(map.data + start, map.size - start);
+	else
+		in = hc_create_reader(in_stream);
+	out = hc_create_writer(out_stream);
+
+	if (!mapped)
+		in->partial = opts->live;
+	in->stats = opts->stats;
+	out->stats = opts->stats;
+
+	hc_encode_stream(in, out, opts);
+	hc_flush_writer(out);
+
+	if (opts->stats != NULL)
+	{
+		opts->stats->bytes_in = hc_reader_tell(in);
+		opts->stats->bytes_out = out->flushed;
+		hc_end_stats(opts->stats);
+	}
+
+	hc_destroy_reader(in);
+
+	/* leave a mapped input read to the end, as a stream would be */
+	if (mapped)
+	{
+		hc_unmap_file(&map);
+		hc_seek(in_stream, 0, SEEK_END);
+	}
+
+	if (ferror(in_stream) || !hc_flush_writer(out))
+	{
+		hc_destroy_writer(out);
+		return 0;
+	}
+
+	hc_destroy_writer(out);
+
+	return 1;
+}
+
+size_t hc_encode_buffer(const void* src, size_t len, void* dst, size_t cap)
+{
+	hc_options opts;
+
+	hc_init_options(&opts);
+
+	return hc_encode_buffer_ex(src, len, dst, cap, &opts);
+}
+
+size_t hc_encode_buffer_ex(const void* src, size_t len, void* dst,
+	size_t cap, const hc_options* opts)
+{
+	hc_reader* in;
+	hc_writer* out;
+	size_t size;
+
+	if (opts->stats != NULL)
+		hc_begin_stats(opts->stats);
+
+	in = hc_create_memory_reader(src, len);
+	out = hc_create_buffer_writer(dst, cap);
+
+	hc_encode_stream(in, out, opts);
+
+	size = out->error ? HC_BUFFER_ERROR : out->len;
+
+	if (opts->stats != NULL)
+	{
+		opts->stats->bytes_in = len;
+		opts->stats->bytes_out = out->len;
+		hc_end_stats(opts->stats);
+	}
+
+	hc_destroy_reader(in);
+	hc_destroy_writer(out);
+
+	return size;
+}
+
+size_t hc_compress_bound(size_t len)
+{
+	size_t blocks = (len + HC_BLOCK_SIZE - 1) / HC_BLOCK_SIZE;
+
+	/*
+	 * A Huffman code never takes more bits than the bytes it codes, so
+	 * a block adds at most its marker and size, the longest length
+	 * table, either data section header, the padding of its streams
+	 * and its index entry.
+	 */
+	size_t block = 5 + 2 + 2 * (UCHAR_MAX + 1)
+		+ 3 + 2 * sizeof(hc_ulong) + 4 * HC_STREAMS + HC_STREAMS + 16;
+
+	/* sync points take at most 4 bytes per HC_MIN_SYNC_INTERVAL */
+	block += 9;
+
+	/* stream markers, index marker and trailer */
+	return len + len / (HC_MIN_SYNC_INTERVAL / 4) + blocks * block + 3 + 16;
+}
+
+
+/*
+ * Reads the interleaved streams of a block of size bytes and writes
+ * the decoded bytes to the output.
+ */
+static int hc_decode_section_streams(hc_reader* in, hc_writer* out,
+	hc_decoder* dec, size_t size, hc_stats* stats)
+{
+	hc_ulong bit_counts[HC_STREAMS];
+	size_t bytes = 0;
+	hc_byte* data;
+	unsigned int j;
+	int ok;
+
+	for (j = 0; j < HC_STREAMS; j++)
+	{
+		if (!hc_read_u32(in, &bit_counts[j]))
+			return 0;
+		bytes += (bit_counts[j] + CHAR_BIT - 1) / CHAR_BIT;
+		if (stats != NULL)
+			stats->code_bits += bit_counts[j];
+	}
+
+	data = (hc_byte*)hc_malloc(bytes > 0 ? bytes : 1);
+
+	ok = hc_read(in, data, bytes) == bytes
+		&& hc_read_byte(in) == data_end
+		&& hc_decode_streams(data, bit_counts, size, dec, out);
+
+	free(data);
+
+	return ok;
+}
+
+/* reads past the sync points that may follow the data of a block */
+static int hc_skip_sync_points(hc_reader* in)
+{
+	hc_byte entry[4];
+	hc_ulong interval;
+	hc_ulong count;
+	hc_ulong i;
+
+	if (hc_read_byte(in) != sync_points || !hc_read_u32(in, &interval)
+		|| !hc_read_u32(in, &count))
+	{
+		return 0;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		if (hc_read(in, entry, sizeof(entry)) != sizeof(entry))
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Reads a table and its encoded data and writes the decoded bytes
+ * to the output. Size is the decoded size of the block, if known.
+ */
+static int hc_decode_section(hc_reader* in, hc_writer* out, size_t size,
+	hc_stats* stats)
+{
+	size_t len;
+	size_t i;
+	hc_sym* dict;
+	hc_decoder* dec;
+	hc_bitstring* enc;
+	hc_timer timer;
+	hc_ullong header = hc_reader_tell(in);
+	hc_ullong start = out->flushed + out->len;
+	int ok = 1;
+
+	if (stats != NULL)
+		hc_start_timer(&timer, stats);
+
+	/* read the bit code dictionary from the input stream */
+	dict = hc_read_table(in, &len);
+
+	if (dict == NULL)
+		return 0;
+
+	/* build the lookup tables from the bit code dictionary */
+	dec = hc_create_decoder(dict, len);
+
+	if (stats != NULL)
+	{
+		hc_lap(&timer, &stats->table_time);
+		hc_table_stats(stats, dict, len);
+		stats->header_bytes += hc_reader_tell(in) - header;
+	}
+
+	for (i = 0; i < len; i++)
+		hc_destroy_bitstring(dict[i].code);
+	free(dict);
+
+	if (hc_peek_byte(in) == data_streams)
+	{
+		hc_read_byte(in);
+		ok = hc_decode_section_streams(in, out, dec, size, stats);
+	}
+	else
+	{
+		/* read the encoded data from the input stream */
+		enc = hc_read_data(in);
+
+		/* decode the bit string and write to the output stream */
+		hc_decode_data(enc, dec, out);
+
+		if (stats != NULL)
+			stats->code_bits += enc->bit_count;
+
+		hc_destroy_bitstring(enc);
+
+		/* sync points only matter when decoding a range */
+		if (hc_peek_byte(in) == sync_points)
+			ok = hc_skip_sync_points(in);
+	}
+
+	hc_destroy_decoder(dec);
+
+	if (stats != NULL)
+	{
+		hc_lap(&timer, &stats->code_time);
+		stats->symbols += out->flushed + out->len - start;
+	}
+
+	return ok;
+}
+
+/*
+ * Copies size bytes of a stored block out from skip bytes into it, or
+ * repeats the byte of a run, in pieces no larger than the output
+ * buffer. Only memory readers skip.
+ */
+static int hc_decode_raw_block(hc_reader* in, hc_writer* out, size_t skip,
+	size_t size)
+{
+	int stored = hc_read_byte(in) == block_stored;
+	int b = stored ? 0 : hc_read_byte(in);
+
+	if (b == EOF)
+		return 0;
+
+	if (stored && skip > 0)
+	{
+		if (in->stream != NULL || skip > in->len - in->pos)
+			return 0;
+		in->pos += skip;
+	}
+
+	while (size > 0)
+	{
+		size_t n = size < out->cap ? size : out->cap;
+
+		if (!hc_reserve(out, n))
+			return 0;
+
+		if (stored && hc_read(in, out->buf + out->len, n) != n)
+			return 0;
+		else if (!stored)
+			memset(out->buf + out->len, b, n);
+
+		out->len += n;
+		size -= n;
+	}
+
+	return 1;
+}
+
+/*
+ * Decodes a block coded by the byte before each byte, switching to
+ * the table of the previous byte's cluster for every byte. Size is
+ * the decoded size of the block.
+ */
+static int hc_decode_context_block(hc_reader* in, hc_writer* out,
+	size_t size, hc_stats* stats)
+{
+	hc_decoder* decs[HC_MAX_CONTEXTS];
+	hc_byte map[UCHAR_MAX + 1];
+	hc_bitreader br;
+	hc_byte* data = NULL;
+	hc_ulong bit_count = 0;
+	hc_timer timer;
+	hc_ullong header = hc_reader_tell(in);
+	unsigned int count = 0;
+	size_t bytes = 0;
+	size_t len;
+	size_t i;
+	hc_byte prev = 0;
+	int k = 0;
+	int ok;
+
+	if (stats != NULL)
+		hc_start_timer(&timer, stats);
+
+	ok = hc_read_byte(in) == block_contexts && (k = hc_read_byte(in)) >= 2
+		&& k <= HC_MAX_CONTEXTS;
+
+	if (ok && k <= 16)
+	{
+		/* two clusters to a byte, expanded from the back */
+		ok = hc_read(in, map, sizeof(map) / 2) == sizeof(map) / 2;
+		for (i = sizeof(map) / 2; ok && i > 0; i--)
+		{
+			map[2 * i - 1] = map[i - 1] >> 4;
+			map[2 * i - 2] = map[i - 1] & 0xF;
+		}
+	}
+	else if (ok)
+	{
+		ok = hc_read(in, map, sizeof(map)) == sizeof(map);
+	}
+
+	for (i = 0; ok && i < sizeof(map); i++)
+		ok = map[i] < k;
+
+	while (ok && count < (unsigned int)k)
+	{
+		hc_sym* dict = hc_read_table(in, &len);
+
+		if (dict == NULL)
+		{
+			ok = 0;
+			break;
+		}
+
+		decs[count++] = hc_create_decoder(dict, len);
+
+		if (stats != NULL)
+			hc_table_stats(stats, dict, len);
+
+		for (i = 0; i < len; i++)
+			hc_destroy_bitstring(dict[i].code);
+		free(dict);
+	}
+
+	if (stats != NULL)
+	{
+		hc_lap(&timer, &stats->table_time);
+		stats->header_bytes += hc_reader_tell(in) - header;
+	}
+
+	if (ok && hc_read_u32(in, &bit_count))
+	{
+		bytes = (bit_count + CHAR_BIT - 1) / CHAR_BIT;
+		data = (hc_byte*)hc_malloc(bytes > 0 ? bytes : 1);
+		ok = hc_read(in, data, bytes) == bytes && hc_read_byte(in) == data_end;
+	}
+	else
+	{
+		ok = 0;
+	}
+
+	if (ok)
+		hc_init_bits(&br, data, bytes);
+
+	for (i = 0; ok && i < size; i++)
+	{
+		hc_decoder* dec = decs[map[prev]];
+		int sym;
+
+		if (dec->entries != NULL)
+		{
+			hc_decode_entry e;
+
+			if (br.count < HC_DECODE_MAX_BITS)
+				hc_refill_bits(&br);
+
+			e = hc_lookup(dec, br.buf);
+			br.buf >>= e.len;
+			br.count -= e.len;
+			sym = e.len > 0 ? e.sym : -1;
+		}
+		else
+		{
+			/* codes too long for the tables are walked one bit at a time */
+			sym = hc_walk_symbol(dec, &br);
+		}
+
+		if (sym < 0 || (out->len == out->cap && !hc_reserve(out, 1)))
+			ok = 0;
+		else
+			out->buf[out->len++] = prev = (hc_byte)sym;
+	}
+
+	/* the codes have to use up the data exactly */
+	ok = ok && (hc_ullong)(br.in - data + br.pad) * CHAR_BIT - br.count
+		== bit_count;
+
+	if (stats != NULL)
+	{
+		hc_lap(&timer, &stats->code_time);
+		stats->code_bits += bit_count;
+		stats->symbols += size;
+	}
+
+	while (count > 0)
+		hc_destroy_decoder(decs[--count]);
+	free(data);
+
+	return ok;
+}
+
+/* decodes a block whose marker has already been read */
+static int hc_decode_block(hc_reader* in, hc_writer* out, hc_stats* stats)
+{
+	hc_ullong start = out->flushed + out->len;
+	hc_ulong size;
+	int ok;
+
+	if (stats != NULL)
+		stats->blocks++;
+
+	if (!hc_read_u32(in, &size))
+		return 0;
+
+	if (hc_peek_byte(in) == block_stored || hc_peek_byte(in) == block_rle)
+	{
+		double t = stats != NULL ? hc_now() : 0;
+
+		ok = hc_decode_raw_block(in, out, 0, size);
+
+		if (stats != NULL)
+		{
+			stats->code_time += hc_now() - t;
+			stats->symbols += size;
+		}
+	}
+	else if (hc_peek_byte(in) == block_contexts)
+	{
+		ok = hc_decode_context_block(in, out, size, stats);
+	}
+	else
+	{
+		ok = hc_decode_section(in, out, size, stats);
+	}
+
+	return ok && !out->error && out->flushed + out->len - start == size;
+}
+
+/* one encoded block and the slice of output it decodes into */
+typedef struct hc_decode_job {
+	hc_byte* data;
+	size_t size;
+	size_t cap;
+	hc_byte* out;
+	size_t raw_size;
+	int ok;
+} hc_decode_job;
+
+/* the share of a batch of jobs taken on by one worker */
+typedef struct hc_decode_worker {
+	hc_task task;
+	hc_decode_job* jobs;
+	size_t count;
+	size_t first;
+	size_t step;
+	hc_stats* stats; /* the worker's own stats, if collected */
+	hc_stats own;
+} hc_decode_worker;
+
+static void hc_run_decode_worker(void* arg)
+{
+	hc_decode_worker* worker = (hc_decode_worker*)arg;
+	size_t i;
+
+	for (i = worker->first; i < worker->count; i += worker->step)
+	{
+		hc_decode_job* job = &(worker->jobs[i]);
+		hc_reader* in = hc_create_memory_reader(job->data, job->size);
+		hc_writer* out = hc_create_buffer_writer(job->out, job->raw_size);
+
+		job->ok = hc_read_byte(in) == block_begin
+			&& hc_decode_block(in, out, worker->stats)
+			&& out->len == job->raw_size;
+
+		hc_destroy_reader(in);
+		hc_destroy_writer(out);
+	}
+}
+
+/* gives each worker stats of its own if the call collects them */
+static void hc_init_decode_workers(hc_decode_worker* workers,
+	unsigned int threads, hc_stats* stats)
+{
+	unsigned int i;
+
+	for (i = 0; i < threads; i++)
+	{
+		workers[i].stats = stats != NULL ? &workers[i].own : NULL;
+		memset(&workers[i].own, 0, sizeof(hc_stats));
+	}
+}
+
+static void hc_merge_decode_workers(hc_decode_worker* workers,
+	unsigned int threads, hc_stats* stats)
+{
+	unsigned int i;
+
+	for (i = 0; stats != NULL && i < threads; i++)
+		hc_add_stats(stats, &workers[i].own);
+}
+
+/* a batch of decode jobs sharing one output buffer */
+typedef struct hc_decode_batch {
+	hc_decode_job* jobs;
+	size_t count;
+	hc_byte* out;
+	size_t out_len;
+	size_t out_cap;
+} hc_decode_batch;
+
+/*
+ * Reads the encoded blocks of the next batch and lays out where
+ * each one decodes to. Returns 0 if the input is cut short.
+ */
+static int hc_read_decode_batch(hc_reader* in, hc_decode_batch* batch,
+	hc_block_info* blocks, hc_ulong count, size_t size)
+{
+	size_t i;
+
+	batch->count = count < size ? (size_t)count : size;
+	batch->out_len = 0;
+
+	for (i = 0; i < batch->count; i++)
+		batch->out_len += blocks[i].raw_size;
+
+	if (batch->out_len > batch->out_cap)
+	{
+		batch->out_cap = batch->out_len;
+		batch->out = (hc_byte*)hc_realloc(batch->out, batch->out_cap);
+	}
+
+	batch->out_len = 0;
+
+	for (i = 0; i < batch->count; i++)
+	{
+		hc_decode_job* job = &(batch->jobs[i]);
+
+		if (blocks[i].size > job->cap)
+		{
+			job->cap = blocks[i].size;
+			job->data = (hc_byte*)hc_realloc(job->data, job->cap);
+		}
+
+		job->size = blocks[i].size;
+		job->raw_size = blocks[i].raw_size;
+		job->out = batch->out + batch->out_len;
+		job->ok = 0;
+		batch->out_len += job->raw_size;
+
+		if (hc_read(in, job->data, job->size) != job->size)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Decodes the blocks listed in an index on several threads. Each
+ * block decodes straight into its place in a batch output buffer,
+ * which is written out while the next batch is being decoded.
+ */
+static int hc_decode_parallel(hc_reader* in, hc_writer* out,
+	hc_block_info* blocks, hc_ulong count, unsigned int threads,
+	hc_stats* stats)
+{
+	size_t size = (size_t)threads * 2;
+	hc_decode_batch batches[2];
+	hc_decode_worker* workers;
+	hc_ulong next_block = 0;
+	size_t i;
+	int cur;
+	int prev = -1;
+	int ok = 1;
+
+	workers = (hc_decode_worker*)hc_malloc(sizeof(hc_decode_worker) * threads);
+	hc_init_decode_workers(workers, threads, stats);
+
+	for (cur = 0; cur < 2; cur++)
+	{
+		batches[cur].jobs = (hc_decode_job*)
+			hc_calloc(size, sizeof(hc_decode_job));
+		batches[cur].count = 0;
+		batches[cur].out = NULL;
+		batches[cur].out_len = 0;
+		batches[cur].out_cap = 0;
+	}
+
+	cur = 0;
+	ok = hc_read_decode_batch(in, &batches[cur], blocks, count, size);
+	next_block = batches[cur].count;
+
+	while (ok && batches[cur].count > 0)
+	{
+		int next = 1 - cur;
+
+		for (i = 0; i < threads; i++)
+		{
+			workers[i].jobs = batches[cur].jobs;
+			workers[i].count = batches[cur].count;
+			workers[i].first = i;
+			workers[i].step = threads;
+			hc_start_task(&(workers[i].task), hc_run_decode_worker, &workers[i]);
+		}
+
+		/* write the previous batch and read the next one meanwhile */
+		if (prev >= 0)
+			hc_write(out, batches[prev].out, batches[prev].out_len);
+
+		ok = hc_read_decode_batch(in, &batches[next],
+			blocks + next_block, count - next_block, size);
+		next_block += batches[next].count;
+
+		for (i = 0; i < threads; i++)
+			hc_join_task(&(workers[i].task));
+
+		for (i = 0; i < batches[cur].count; i++)
+			ok = ok && batches[cur].jobs[i].ok;
+
+		prev = cur;
+		cur = next;
+	}
+
+	if (ok && prev >= 0)
+		hc_write(out, batches[prev].out, batches[prev].out_len);
+
+	for (cur = 0; cur < 2; cur++)
+	{
+		for (i = 0; i < size; i++)
+			free(batches[cur].jobs[i].data);
+		free(batches[cur].jobs);
+		free(batches[cur].out);
+	}
+
+	hc_merge_decode_workers(workers, threads, stats);
+	free(workers);
+
+	return ok && hc_read_byte(in) == stream_end;
+}
+
+/*
+ * Checks that an index lists contiguous blocks starting right
+ * after the stream marker at the given position.
+ */
+static int hc_check_index(hc_block_info* blocks, hc_ulong count,
+	long long start)
+{
+	hc_ullong offset = (hc_ullong)start + 1;
+	hc_ulong i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (blocks[i].offset != offset || blocks[i].size == 0)
+			return 0;
+		offset += blocks[i].size;
+	}
+
+	return 1;
+}
+
+/*
+ * Decodes every block listed in an index from memory straight into
+ * its place in the output, sharing the blocks out between threads.
+ */
+static int hc_decode_blocks(const hc_byte* in, hc_byte* out,
+	hc_block_info* blocks, hc_ulong count, unsigned int threads,
+	hc_stats* stats)
+{
+	hc_decode_job* jobs;
+	hc_decode_worker* workers;
+	size_t pos = 0;
+	hc_ulong i;
+	int ok = 1;
+
+	if (count == 0)
+		return 1;
+
+	if (threads < 1)
+		threads = 1;
+	if (threads > count)
+		threads = (unsigned int)count;
+
+	jobs = (hc_decode_job*)hc_calloc(count, sizeof(hc_decode_job));
+	workers = (hc_decode_worker*)hc_malloc(sizeof(hc_decode_worker) * threads);
+	hc_init_decode_workers(workers, threads, stats);
+
+	for (i = 0; i < count; i++)
+	{
+		jobs[i].data = (hc_byte*)in + blocks[i].offset;
+		jobs[i].size = blocks[i].size;
+		jobs[i].out = out + pos;
+		jobs[i].raw_size = blocks[i].raw_size;
+		pos += blocks[i].raw_size;
+	}
+
+	for (i = 0; i < threads; i++)
+	{
+		workers[i].jobs = jobs;
+		workers[i].count = count;
+		workers[i].first = i;
+		workers[i].step = threads;
+	}
+
+	/* the calling thread takes the first share itself */
+	for (i = 1; i < threads; i++)
+		hc_start_task(&(workers[i].task), hc_run_decode_worker, &workers[i]);
+
+	hc_run_decode_worker(&workers[0]);
+
+	for (i = 1; i < threads; i++)
+		hc_join_task(&(workers[i].task));
+
+	for (i = 0; i < count; i++)
+		ok = ok && jobs[i].ok;
+
+	hc_merge_decode_workers(workers, threads, stats);
+	free(workers);
+	free(jobs);
+
+	return ok;
+}
+
+/*
+ * Decodes a mapped file with a block index into a mapped output file,
+ * sized up front from the index. Returns 0 if either file cannot be
+ * mapped or the input has no usable index, before anything is read
+ * or written; otherwise sets ok to whether decoding succeeded.
+ */
+static int hc_decode_mapped(FILE* in_stream, FILE* out_stream,
+	const hc_options* opts, int* ok)
+{
+	hc_mapping in_map;
+	hc_mapping out_map;
+	hc_block_info* blocks;
+	hc_ulong count;
+	hc_ullong total = 0;
+	hc_ullong end;
+	long long start = hc_tell(in_stream);
+	long long out_pos;
+	hc_ulong i;
+
+	if (start < 0 || !hc_map_file(in_stream, &in_map, 0))
+		return 0;
+
+	blocks = hc_read_index(in_stream, &count);
+
+	end = count > 0 ? blocks[count - 1].offset + blocks[count - 1].size
+		: (hc_ullong)start + 1;
+
+	if (blocks == NULL || !hc_check_index(blocks, count, start)
+		|| end >= in_map.size || in_map.data[start] != stream_begin)
+	{
+		free(blocks);
+		hc_unmap_file(&in_map);
+		return 0;
+	}
+
+	for (i = 0; i < count; i++)
+		total += blocks[i].raw_size;
+
+	fflush(out_stream);
+	out_pos = hc_tell(out_stream);
+
+	if (total == 0 || out_pos < 0
+		|| !hc_map_file(out_stream, &out_map, (hc_ullong)out_pos + total))
+	{
+		free(blocks);
+		hc_unmap_file(&in_map);
+		return 0;
+	}
+
+	*ok = hc_decode_blocks(in_map.data, out_map.data + out_pos, blocks, count,
+		opts->threads, opts->stats) && in_map.data[end] == stream_end;
+
+	if (opts->stats != NULL)
+	{
+		opts->stats->bytes_in = end + 1 - start;
+		opts->stats->bytes_out = total;
+	}
+
+	*ok = hc_unmap_file(&out_map) && *ok;
+	hc_unmap_file(&in_map);
+	free(blocks);
+
+	/* leave both files where streaming would have */
+	hc_seek(in_stream, (long long)end + 1, SEEK_SET);
+	hc_seek(out_stream, 0, SEEK_END);
+
+	return 1;
+}
+
+/*
+ * Decodes a stream of blocks, or a single section of a file without
+ * blocks. Given an index, the blocks are decoded on several threads.
+ */
+static int hc_decode_stream(hc_reader* in, hc_writer* out,
+	hc_block_info* blocks, hc_ulong count, unsigned int threads,
+	hc_stats* stats)
+{
+	int ok = 1;
+
+	if (hc_peek_byte(in) == stream_begin)
+	{
+		hc_read_byte(in);
+
+		if (blocks != NULL)
+			return hc_decode_parallel(in, out, blocks, count, threads, stats);
+
+		/* decode blocks until the end of the stream */
+		while (ok)
+		{
+			int b = hc_read_byte(in);
+
+			if (b == stream_end)
+				break;
+
+			ok = b == block_begin && hc_decode_block(in, out, stats);
+		}
+
+		return ok;
+	}
+
+	if (hc_peek_byte(in) == adaptive_begin)
+	{
+		hc_read_byte(in);
+		return hc_decode_adaptive(in, out);
+	}
+
+	/* files without blocks hold a single table and data section */
+	return hc_decode_section(in, out, 0, stats);
+}
+
+int hc_decode_file(FILE *in_stream, FILE *out_stream)
+{
+	hc_options opts;
+
+	hc_init_options(&opts);
+
+	return hc_decode_file_ex(in_stream, out_stream, &opts);
+}
+
+int hc_decode_file_ex(FILE *in_stream, FILE *out_stream,
+	const hc_options* opts)
+{
+	hc_reader* in;
+	hc_writer* out;
+	hc_block_info* blocks = NULL;
+	hc_ulong count = 0;
+	int ok = 1;
+
+	if (opts->stats != NULL)
+		hc_begin_stats(opts->stats);
+
+	if (opts->map && hc_decode_mapped(in_stream, out_stream, opts, &ok))
+	{
+		if (opts->stats != NULL)
+			hc_end_stats(opts->stats);
+		return ok;
+	}
+
+	/* the block index is only reachable on seekable input */
+	if (opts->threads > 1)
+	{
+		long long start = hc_tell(in_stream);
+
+		blocks = hc_read_index(in_stream, &count);
+
+		if (blocks != NULL && !hc_check_index(blocks, count, start))
+		{
+			free(blocks);
+			blocks = NULL;
+		}
+	}
+
+	in = hc_create_reader(in_stream);
+	in->partial = opts->live;
+	in->stats = opts->stats;
+	out = hc_create_writer(out_stream);
+	out->stats = opts->stats;
+
+	ok = hc_decode_stream(in, out, blocks, count, opts->threads,
+		opts->stats);
+	ok = hc_flush_writer(out) && ok;
+
+	if (opts->stats != NULL)
+	{
+		opts->stats->bytes_in = hc_reader_tell(in);
+		opts->stats->bytes_out = out->flushed;
+		hc_end_stats(opts->stats);
+	}
+
+	free(blocks);
+	hc_destroy_reader(in);
+
+	if (!ok || ferror(in_stream))
+	{
+		hc_destroy_writer(out);
+		return 0;
+	}
+
+	hc_destroy_writer(out);
+
+	return 1;
+}
+
+/*
+ * Decodes skip + take bytes from a bit reader holding left bits of
+ * data, writing out only the last take of them.
+ */
+static int hc_decode_count(hc_decoder* dec, hc_bitreader* br,
+	hc_ullong left, size_t skip, size_t take, hc_writer* out)
+{
+	size_t i;
+
+	for (i = 0; i < skip + take; i++)
+	{
+		int sym;
+
+		if (dec->entries == NULL)
+		{
+			sym = hc_walk_symbol(dec, br);
+		}
+		else
+		{
+			hc_decode_entry e;
+
+			hc_refill_bits(br);
+			e = hc_lookup(dec, br->buf);
+
+			if (e.len == 0 || e.len > left)
+				return 0;
+
+			br->buf >>= e.len;
+			br->count -= e.len;
+			left -= e.len;
+			sym = e.sym;
+		}
+
+		if (sym < 0)
+			return 0;
+
+		if (i >= skip)
+			hc_write_byte(out, (hc_byte)sym);
+	}
+
+	return !out->error;
+}
+
+/*
+ * Decodes take bytes of a single stream data section from a memory
+ * reader, starting skip bytes into it, from the closest sync point
+ * before them if the section is followed by sync points.
+ */
+static int hc_decode_data_range(hc_reader* in, hc_sym* dict, size_t len,
+	size_t skip, size_t take, hc_writer* out)
+{
+	hc_decoder* dec;
+	hc_bitreader br;
+	const hc_byte* bytes;
+	hc_ulong bit_count;
+	hc_ulong byte_count;
+	hc_ulong interval = 0;
+	hc_ulong count = 0;
+	hc_ulong start = 0;
+	hc_ulong k = 0;
+	int ok;
+
+	if (hc_read_byte(in) != data_begin
+		|| hc_read(in, &bit_count, sizeof(hc_ulong)) != sizeof(hc_ulong)
+		|| hc_read(in, &byte_count, sizeof(hc_ulong)) != sizeof(hc_ulong)
+		|| hc_read_byte(in) == EOF
+		|| byte_count > in->len - in->pos
+		|| bit_count > (hc_ullong)byte_count * CHAR_BIT)
+	{
+		return 0;
+	}
+
+	bytes = in->buf + in->pos;
+	in->pos += byte_count;
+
+	if (hc_read_byte(in) == data_end && hc_read_byte(in) == sync_points
+		&& hc_read_u32(in, &interval) && hc_read_u32(in, &count)
+		&& interval > 0 && count <= (in->len - in->pos) / 4)
+	{
+		k = (hc_ulong)(skip / interval);
+		if (k > count)
+			k = count;
+		if (k > 0)
+			start = hc_get_u32(in->buf + in->pos + (k - 1) * 4);
+	}
+
+	if (start > bit_count)
+		return 0;
+
+	dec = hc_create_decoder(dict, len);
+
+	hc_init_bits(&br, bytes + start / CHAR_BIT, byte_count - start / CHAR_BIT);
+	hc_refill_bits(&br);
+	br.buf >>= start % CHAR_BIT;
+	br.count -= start % CHAR_BIT;
+
+	ok = hc_decode_count(dec, &br, bit_count - start,
+		skip - (size_t)k * interval, take, out);
+
+	hc_destroy_decoder(dec);
+
+	return ok;
+}
+
+/*
+ * Decodes take bytes of a block held in memory, starting skip bytes
+ * into it. Blocks with sync points are decoded from the closest one
+ * before the range, others from their start.
+ */
+static int hc_decode_block_range(const hc_byte* data, size_t size,
+	size_t skip, size_t take, hc_writer* out)
+{
+	hc_reader* in = hc_create_memory_reader(data, size);
+	hc_sym* dict = NULL;
+	hc_ulong raw_size;
+	size_t len = 0;
+	size_t i;
+	int ok;
+
+	ok = hc_read_byte(in) == block_begin && hc_read_u32(in, &raw_size)
+		&& skip + take <= raw_size;
+
+	/* stored blocks and runs are sliced without decoding */
+	if (ok && (hc_peek_byte(in) == block_stored
+		|| hc_peek_byte(in) == block_rle))
+	{
+		ok = hc_decode_raw_block(in, out, skip, take);
+
+		hc_destroy_reader(in);
+		return ok && !out->error;
+	}
+
+	if (ok && hc_peek_byte(in) != block_contexts)
+		ok = (dict = hc_read_table(in, &len)) != NULL;
+
+	if (ok && dict != NULL && hc_peek_byte(in) == data_begin)
+	{
+		ok = hc_decode_data_range(in, dict, len, skip, take, out);
+	}
+	else if (ok)
+	{
+		/*
+		 * interleaved streams and context blocks have no sync points,
+		 * so decode them whole
+		 */
+		hc_writer* block = hc_create_memory_writer(raw_size);
+
+		in->pos = 0;
+		ok = hc_read_byte(in) == block_begin
+			&& hc_decode_block(in, block, NULL);
+		if (ok)
+			hc_write(out, block->buf + skip, take);
+
+		hc_destroy_writer(block);
+	}
+
+	if (dict != NULL)
+	{
+		for (i = 0; i < len; i++)
+			hc_destroy_bitstring(dict[i].code);
+		free(dict);
+	}
+
+	hc_destroy_reader(in);
 
-			flag = fread(&ul, sizeof(hc_ulong), 1, in_stream);
-			sym.code->bit_count = ul;
+	return ok && !out->error;
+}
 
-			flag = fread(&ul, sizeof(hc_ulong), 1, in_stream);
-			sym.code->byte_count = ul;
+int hc_decode_range(FILE* in_stream, hc_ullong offset, hc_ullong length,
+	FILE* out_stream)
+{
+	hc_block_info* blocks;
+	hc_writer* out;
+	hc_byte* data = NULL;
+	size_t cap = 0;
+	hc_ulong count;
+	hc_ulong i;
+	hc_ullong pos = 0;
+	hc_ullong end = offset + length < offset ? ~(hc_ullong)0 : offset + length;
+	long long start = hc_tell(in_stream);
+	int ok = 1;
 
-			flag = fread(&b, sizeof(hc_byte), 1, in_stream);
-			sym.code->current_bits = b;
+	/* ranges are found through the block index */
+	blocks = hc_read_index(in_stream, &count);
 
-			sym.code->bytes = (hc_byte*)
-				malloc(sizeof(hc_byte) * sym.code->byte_count);
+	if (blocks == NULL || !hc_check_index(blocks, count, start))
+	{
+		free(blocks);
+		return 0;
+	}
 
-			flag = fread(sym.code->bytes, sizeof(hc_byte),
-				sym.code->byte_count, in_stream);
+	out = hc_create_writer(out_stream);
 
-			/* resize the dictionary if necessary */
-			if (count >= cap)
+	for (i = 0; ok && i < count && pos < end; i++)
+	{
+		hc_ullong next = pos + blocks[i].raw_size;
+
+		/* only the blocks that overlap the range are read */
+		if (next > offset)
+		{
+			size_t skip = offset > pos ? (size_t)(offset - pos) : 0;
+			size_t take = (size_t)((end < next ? end : next) - pos) - skip;
+
+			if (blocks[i].size > cap)
 			{
-				size_t new_cap = cap + cap / 2;
-				table = (hc_sym*)realloc(table, sizeof(hc_sym) * new_cap);
-				cap = new_cap;
+				cap = blocks[i].size;
+				data = (hc_byte*)hc_realloc(data, cap);
 			}
 
-			/* add the symbol to the dictionary */
-			table[count++] = sym;
-		}
-		else if (b == table_end)
-		{
-			flag = 0;
+			ok = hc_seek(in_stream, (long long)blocks[i].offset, SEEK_SET)
+				&& fread(data, 1, blocks[i].size, in_stream) == blocks[i].size
+				&& hc_decode_block_range(data, blocks[i].size, skip, take, out);
 		}
-	}
 
-	/* free excess memory */
-	if (count < cap)
-	{
-		table = (hc_sym*)realloc(table, sizeof(hc_sym) * count);
+		pos = next;
 	}
 
-	*len = count;
+	free(data);
+	free(blocks);
 
-	return table;
+	ok = hc_flush_writer(out) && ok;
+	hc_destroy_writer(out);
+
+	return ok;
 }
 
-void hc_write_data(FILE *out_stream, hc_bitstring *bs)
+size_t hc_decode_buffer(const void* src, size_t len, void* dst, size_t cap)
 {
-	hc_ulong i;
+	hc_options opts;
 
-	fwrite(&data_begin, sizeof(hc_byte), 1, out_stream);
+	hc_init_options(&opts);
 
-	/* write the bit string metadata */
-	fwrite(&(bs->bit_count), sizeof(hc_ulong), 1, out_stream);
-	fwrite(&(bs->byte_count), sizeof(hc_ulong), 1, out_stream);
-	fwrite(&(bs->current_bits), sizeof(hc_byte), 1, out_stream);
+	return hc_decode_buffer_ex(src, len, dst, cap, &opts);
+}
 
-	/* write the bit code data */
-	for (i = 0; i < bs->byte_count; i++)
+size_t hc_decode_buffer_ex(const void* src, size_t len, void* dst,
+	size_t cap, const hc_options* opts)
+{
+	const hc_byte* data = (const hc_byte*)src;
+	hc_block_info* blocks = NULL;
+	hc_ulong count = 0;
+	hc_reader* in;
+	hc_writer* out;
+	size_t size;
+
+	if (opts->stats != NULL)
 	{
-		fwrite(&(bs->bytes[i]), sizeof(hc_byte), 1, out_stream);
+		hc_begin_stats(opts->stats);
+		opts->stats->bytes_in = len;
 	}
 
-	fwrite(&data_end, sizeof(hc_byte), 1, out_stream);
-}
+	/* with an index every block decodes straight into its place */
+	if (opts->threads > 1)
+		blocks = hc_parse_index(data, len, &count);
 
-hc_bitstring* hc_read_data(FILE* in_stream)
-{
-	hc_bitstring* bs = hc_create_bitstring();
+	if (blocks != NULL)
+	{
+		hc_ullong end = count > 0
+			? blocks[count - 1].offset + blocks[count - 1].size : 1;
+		hc_ullong total = 0;
+		hc_ulong i;
 
-	/* dispose of this since we create it later */
-	free(bs->bytes);
+		for (i = 0; i < count; i++)
+			total += blocks[i].raw_size;
 
-	hc_ulong ul;
-	hc_byte b;
-	size_t flag = 1;
+		if (hc_check_index(blocks, count, 0) && end < len
+			&& data[0] == stream_begin)
+		{
+			int ok = total <= cap
+				&& hc_decode_blocks(data, (hc_byte*)dst, blocks, count,
+					opts->threads, opts->stats)
+				&& data[end] == stream_end;
 
-	flag = fread(&b, sizeof(hc_byte), 1, in_stream);
+			free(blocks);
 
-	if (b == data_begin)
-	{
-		fread(&ul, sizeof(hc_ulong), 1, in_stream);
-		bs->bit_count = ul;
+			if (opts->stats != NULL)
+			{
+				opts->stats->bytes_out = ok ? total : 0;
+				hc_end_stats(opts->stats);
+			}
 
-		fread(&ul, sizeof(hc_ulong), 1, in_stream);
-		bs->byte_count = ul;
+			return ok ? (size_t)total : HC_BUFFER_ERROR;
+		}
+
+		free(blocks);
+	}
 
-		fread(&b, sizeof(hc_byte), 1, in_stream);
-		bs->current_bits = b;
+	in = hc_create_memory_reader(src, len);
+	out = hc_create_buffer_writer(dst, cap);
 
-		bs->bytes = (hc_byte*)malloc(sizeof(hc_byte) * bs->byte_count);
+	size = hc_decode_stream(in, out, NULL, 0, 1, opts->stats) && !out->error
+		? out->len : HC_BUFFER_ERROR;
 
-		flag = fread(bs->bytes, sizeof(hc_byte), bs->byte_count, in_stream);
+	if (opts->stats != NULL)
+	{
+		opts->stats->bytes_out = out->len;
+		hc_end_stats(opts->stats);
 	}
 
-	return bs;
+	hc_destroy_reader(in);
+	hc_destroy_writer(out);
+
+	return size;
 }
 
-static void hc_build_branch(hc_node** node, hc_byte* bytes, hc_sym data,
-	hc_byte byte, hc_ulong bit, hc_ulong bit_count, hc_ulong bit_cap)
+/* a symbol of a wide alphabet and its count, for building codes */
+typedef struct hc_wide_sym {
+	hc_ullong f;
+	hc_uint sym;
+} hc_wide_sym;
+
+/* one entry of a decode table for a wide alphabet, as hc_decode_entry */
+typedef struct hc_wide_entry {
+	hc_uint sym; /* symbol, or offset of a secondary table */
+	hc_byte len; /* code length (0 for links and unused entries) */
+	hc_byte sub; /* index width of the secondary table for links */
+} hc_wide_entry;
+
+/* orders wide symbols by count, then by value */
+static int hc_compare_wide(const void* a, const void* b)
 {
-	if (bit_count == bit_cap)
+	const hc_wide_sym* x = (const hc_wide_sym*)a;
+	const hc_wide_sym* y = (const hc_wide_sym*)b;
+
+	if (x->f != y->f)
+		return x->f < y->f ? -1 : 1;
+
+	return x->sym < y->sym ? -1 : x->sym > y->sym;
+}
+
+/*
+ * Replaces n >= 2 weights sorted in increasing order with their code
+ * lengths in place, by the method of Moffat and Katajainen, so large
+ * alphabets need no tree of nodes.
+ */
+static void hc_minimum_redundancy(hc_ullong* a, long n)
+{
+	long root = 0;
+	long leaf = 2;
+	long next;
+	long avbl = 1;
+	long used = 0;
+	long depth = 0;
+
+	/* pair off the two lightest of the leaves and the merged nodes */
+	a[0] += a[1];
+	for (next = 1; next < n - 1; next++)
 	{
-		if (*node == NULL)
+		if (leaf >= n || a[root] < a[leaf])
 		{
-			*node = hc_create_node();
+			a[next] = a[root];
+			a[root++] = (hc_ullong)next;
+		}
+		else
+		{
+			a[next] = a[leaf++];
 		}
 
-		(*node)->sym = data;
-		(*node)->sym.w = 0;
-
-		return;
+		if (leaf >= n || (root < next && a[root] < a[leaf]))
+		{
+			a[next] += a[root];
+			a[root++] = (hc_ullong)next;
+		}
+		else
+		{
+			a[next] += a[leaf++];
+		}
 	}
 
-	if (bit == CHAR_BIT)
+	/* turn the parent of every merged node into its depth */
+	a[n - 2] = 0;
+	for (next = n - 3; next >= 0; next--)
+		a[next] = a[a[next]] + 1;
+
+	/* and the depths of the merged nodes into those of the leaves */
+	root = n - 2;
+	next = n - 1;
+	while (avbl > 0)
 	{
-		byte++;
-		bit = 0;
+		while (root >= 0 && (long)a[root] == depth)
+		{
+			used++;
+			root--;
+		}
+		while (avbl > used)
+		{
+			a[next--] = (hc_ullong)depth;
+			avbl--;
+		}
+		avbl = 2 * used;
+		depth++;
+		used = 0;
 	}
+}
 
-	hc_node** leaf;
+/*
+ * Caps the code lengths of weights in increasing order at max_len
+ * bits. Codes past the cap are cut to it and the Kraft sum is brought
+ * back to one by moving the longest codes under the cap a level down.
+ * The lengths are then handed out again, shortest to the heaviest.
+ * Unlike the package-merge of hc_limit_code_lengths, whose tables are
+ * sized for byte alphabets, this is not always optimal when the cap
+ * binds, though the codes stay valid and the loss is small.
+ */
+static void hc_limit_wide_lengths(hc_ullong* lens, hc_ulong n,
+	unsigned int max_len)
+{
+	hc_ulong num[HC_MAX_CODE_LEN + 1] = { 0 };
+	hc_ullong total = 0;
+	hc_ulong i;
+	hc_ulong j;
+	unsigned int l;
 
-	if (bytes[byte] & (1 << bit++))
-		leaf = &((*node)->leaf_1);
-	else
-		leaf = &((*node)->leaf_2);
+	if (n == 0 || lens[0] <= max_len)
+		return;
 
-	if (*leaf == NULL)
+	for (i = 0; i < n; i++)
+		num[lens[i] > max_len ? max_len : lens[i]]++;
+
+	for (l = 1; l <= max_len; l++)
+		total += (hc_ullong)num[l] << (max_len - l);
+
+	while (total > (hc_ullong)1 << max_len)
 	{
-		*leaf = hc_create_node();
-		(*leaf)->sym.w = 1;
+		num[max_len]--;
+		for (l = max_len - 1; l > 0; l--)
+		{
+			if (num[l] > 0)
+			{
+				num[l]--;
+				num[l + 1] += 2;
+				break;
+			}
+		}
+		total--;
 	}
 
-	hc_build_branch(leaf, bytes, data, byte, bit, ++bit_count, bit_cap);
+	for (l = 1, i = n; l <= max_len; l++)
+	{
+		for (j = 0; j < num[l]; j++)
+			lens[--i] = l;
+	}
 }
 
-hc_node_list* hc_reconstruct_tree(hc_sym* table, hc_ulong len)
+/*
+ * Gives n symbols canonical codes from their lengths, in the order of
+ * their values, packed first bit lowest. Returns 0 if the lengths
+ * claim more codes than there are.
+ */
+static int hc_wide_codes(const hc_byte* lens, hc_ulong n, hc_uint* codes)
 {
+	hc_ulong count[HC_DECODE_MAX_BITS + 1] = { 0 };
+	hc_ullong next[HC_DECODE_MAX_BITS + 1];
+	hc_ullong code = 0;
 	hc_ulong i;
-	hc_node_list* tree = hc_create_list();
+	unsigned int l;
+	unsigned int j;
 
-	hc_node* root = hc_create_node();
-	root->sym.w = 1;
+	for (i = 0; i < n; i++)
+		count[lens[i]]++;
 
-	hc_add_node(tree, root);
+	count[0] = 0;
+	for (l = 1; l <= HC_DECODE_MAX_BITS; l++)
+	{
+		code = (code + count[l - 1]) << 1;
+		next[l] = code;
+	}
 
-	/*
-	 * leaf_1 => 1
-	 * leaf_2 => 0
-	 */
+	/* the first code of the longest length tells how many are taken */
+	if (code + count[HC_DECODE_MAX_BITS] > (hc_ullong)1 << HC_DECODE_MAX_BITS)
+		return 0;
 
-	for (i = 0; i < len; i++)
+	for (i = 0; i < n; i++)
 	{
-		hc_bitstring* bs = table[i].code;
+		hc_ullong c = next[lens[i]]++;
 
-		hc_build_branch(&root, bs->bytes, table[i],
-			0,            /* current byte              */
-			0,            /* position in current byte  */
-			0,            /* current bit count         */
-			bs->bit_count /* bit capactity             */
-		);
+		codes[i] = 0;
+		for (j = 0; j < lens[i]; j++)
+			codes[i] |= (hc_uint)((c >> (lens[i] - 1 - j)) & 1) << j;
 	}
 
-	return tree;
+	return 1;
 }
 
-void hc_decode_data(hc_bitstring *bs, hc_node_list *tree, FILE *out_stream)
+/*
+ * Builds a decode table for n symbols from their lengths and codes,
+ * laid out like the tables of hc_create_decoder. Bits receives the
+ * index width of the primary table.
+ */
+static hc_wide_entry* hc_create_wide_table(const hc_byte* lens,
+	const hc_uint* codes, hc_ulong n, unsigned int* bits)
 {
-	hc_node* root = tree->nodes;
-	hc_node* leaf = root;
-
-	hc_ulong byte = 0;
-	hc_ulong bit = 0;
+	hc_wide_entry* entries;
+	hc_byte* sub_bits;
+	hc_ulong primary;
+	hc_ulong mask;
+	hc_ulong size;
+	hc_ulong offset;
+	hc_ulong max_len = 0;
 	hc_ulong i;
+	hc_ulong j;
 
-	for (i = 0; i <= bs->bit_count; i++)
+	for (i = 0; i < n; i++)
 	{
-		if (bit == CHAR_BIT)
+		if (lens[i] > max_len)
+			max_len = lens[i];
+	}
+
+	*bits = max_len < HC_DECODE_BITS ? (unsigned int)max_len : HC_DECODE_BITS;
+	if (*bits == 0)
+		*bits = 1;
+
+	primary = (hc_ulong)1 << *bits;
+	mask = primary - 1;
+	sub_bits = (hc_byte*)hc_calloc(primary, sizeof(hc_byte));
+
+	/* find the widest secondary table needed under each prefix */
+	for (i = 0; i < n; i++)
+	{
+		if (lens[i] > *bits && lens[i] - *bits > sub_bits[codes[i] & mask])
+			sub_bits[codes[i] & mask] = (hc_byte)(lens[i] - *bits);
+	}
+
+	size = primary;
+	for (i = 0; i < primary; i++)
+	{
+		if (sub_bits[i] > 0)
+			size += (hc_ulong)1 << sub_bits[i];
+	}
+
+	entries = (hc_wide_entry*)hc_calloc(size, sizeof(hc_wide_entry));
+
+	for (i = 0, offset = primary; i < primary; i++)
+	{
+		if (sub_bits[i] > 0)
 		{
-			byte++;
-			bit = 0;
+			entries[i].sym = (hc_uint)offset;
+			entries[i].sub = sub_bits[i];
+			offset += (hc_ulong)1 << sub_bits[i];
 		}
+	}
 
-		if (leaf->sym.w == 0)
+	/* replicate each code over every index that starts with it */
+	for (i = 0; i < n; i++)
+	{
+		hc_wide_entry e;
+
+		if (lens[i] == 0)
+			continue;
+
+		e.sym = (hc_uint)i;
+		e.len = lens[i];
+		e.sub = 0;
+
+		if (lens[i] <= *bits)
 		{
-			fwrite(&(leaf->sym.b), sizeof(hc_byte), 1, out_stream);
-			leaf = root;
-			i--;
+			for (j = codes[i]; j < primary; j += (hc_ulong)1 << lens[i])
+				entries[j] = e;
 		}
 		else
 		{
-			if (bs->bytes[byte] & (1 << bit++))
-			{
-				leaf = leaf->leaf_1;
-			}
-			else
+			hc_wide_entry link = entries[codes[i] & mask];
+
+			for (j = codes[i] >> *bits; j < (hc_ulong)1 << link.sub;
+				j += (hc_ulong)1 << (lens[i] - *bits))
 			{
-				leaf = leaf->leaf_2;
+				entries[link.sym + j] = e;
 			}
 		}
 	}
+
+	free(sub_bits);
+
+	return entries;
 }
 
-int hc_encode_file(FILE *in_stream, FILE *out_stream)
+/* reads a symbol of the given width */
+static hc_uint hc_get_wide(const void* src, size_t i, unsigned int width)
 {
-	hc_ulong unique;
+	if (width == 2)
+		return ((const hc_ushort*)src)[i];
+
+	return ((const hc_uint*)src)[i];
+}
+
+/* checks the width and alphabet of a wide call, filling in the default */
+static int hc_check_wide(unsigned int width, hc_ulong* alphabet)
+{
+	if (*alphabet == 0)
+		*alphabet = HC_WIDE_ALPHABET;
+
+	if (width == 2 && *alphabet > (hc_ulong)USHRT_MAX + 1)
+		*alphabet = (hc_ulong)USHRT_MAX + 1;
+
+	return (width == 2 || width == 4) && *alphabet <= HC_MAX_ALPHABET;
+}
+
+size_t hc_wide_bound(size_t count, unsigned int width, hc_ulong alphabet)
+{
+	hc_ullong codes;
+
+	if (!hc_check_wide(width, &alphabet))
+		return HC_BUFFER_ERROR;
+
+	/* every code that occurs, the escape among them, has one length */
+	codes = count < alphabet ? count + 1 : alphabet + 1;
+
+	return 27 + (size_t)codes * 4
+		+ count / CHAR_BIT * (HC_DECODE_MAX_BITS + width * CHAR_BIT)
+		+ (count % CHAR_BIT) * (HC_DECODE_MAX_BITS + width * CHAR_BIT) / CHAR_BIT
+		+ 1;
+}
+
+size_t hc_encode_wide(const void* src, size_t count, unsigned int width,
+	hc_ulong alphabet, void* dst, size_t cap)
+{
+	hc_ullong* counts;
+	hc_ullong* weights;
+	hc_wide_sym* syms;
+	hc_byte* lens;
+	hc_uint* codes;
+	hc_writer out;
+	hc_bitwriter bw;
+	hc_ullong bits = 0;
+	hc_ulong unique = 0;
+	hc_ulong prev = 0;
 	hc_ulong i;
-	hc_ulong j;
-	hc_byte b;
+	size_t n;
 
-	hc_sym data[UCHAR_MAX + 1];
-	hc_sym* dict;
-	hc_node_list* tree;
-	hc_bitstring* enc;
+	if (!hc_check_wide(width, &alphabet))
+		return HC_BUFFER_ERROR;
 
-	for (i = 0; i < UCHAR_MAX + 1; i++)
+	/* values past the alphabet share its last code, the escape */
+	counts = (hc_ullong*)hc_calloc(alphabet + 1, sizeof(hc_ullong));
+	for (n = 0; n < count; n++)
 	{
-		data[i].b = (hc_byte)i;
-		data[i].f = 0;
-		data[i].w = 0;
-		data[i].n = 1;
+		hc_uint v = hc_get_wide(src, n, width);
+		counts[v < alphabet ? v : alphabet]++;
 	}
 
-	/* read the data from the input stream */
-	unique = 0;
-	while (fread(&b, 1, 1, in_stream) == 1)
+	for (i = 0; i <= alphabet; i++)
+		unique += counts[i] > 0;
+
+	syms = (hc_wide_sym*)hc_malloc(sizeof(hc_wide_sym) * (unique + 1));
+	weights = (hc_ullong*)hc_malloc(sizeof(hc_ullong) * (unique + 1));
+	lens = (hc_byte*)hc_calloc(alphabet + 1, sizeof(hc_byte));
+	codes = (hc_uint*)hc_malloc(sizeof(hc_uint) * (alphabet + 1));
+
+	for (i = 0, unique = 0; i <= alphabet; i++)
 	{
-		if (data[b].f == 0)
+		if (counts[i] > 0)
 		{
+			syms[unique].f = counts[i];
+			syms[unique].sym = (hc_uint)i;
 			unique++;
-			data[b].code = hc_create_bitstring();
 		}
-		data[b].f++;
 	}
 
-	fseek(in_stream, 0, SEEK_SET);
+	qsort(syms, unique, sizeof(hc_wide_sym), hc_compare_wide);
+
+	for (i = 0; i < unique; i++)
+		weights[i] = syms[i].f;
 
-	tree = hc_create_list();
+	/* a lone symbol still needs a one bit code */
+	if (unique == 1)
+		weights[0] = 1;
+	else if (unique > 1)
+		hc_minimum_redundancy(weights, (long)unique);
 
-	/* create a leaf node for each unique byte */
-	for (i = 0, j = 0; i < UCHAR_MAX + 1; i++)
+	hc_limit_wide_lengths(weights, unique, HC_DECODE_MAX_BITS);
+
+	for (i = 0; i < unique; i++)
 	{
-		if (data[i].f > 0)
-		{
-			/*
-			 * nodes created here will be destroyed when
-			 * the tree is destroyed.
-			 */
-			hc_node *node = malloc(sizeof(hc_node));
-			node->next = NULL;
-			node->leaf_1 = NULL;
-			node->leaf_2 = NULL;
-			node->sym = data[i];
-			hc_add_node(tree, node);
-			j++;
-		}
+		lens[syms[i].sym] = (hc_byte)weights[i];
+		bits += syms[i].f * weights[i];
 	}
 
-	/* sort the leave by frequency */
-	hc_sort_leaves(tree);
+	bits += counts[alphabet] * width * CHAR_BIT;
+	hc_wide_codes(lens, alphabet + 1, codes);
+
+	/* a writer on the stack, as in hc_codebook_encode */
+	out.stream = NULL;
+	out.buf = (hc_byte*)dst;
+	out.cap = cap;
+	out.len = 0;
+	out.flushed = 0;
+	out.fixed = 1;
+	out.error = 0;
+	out.stats = NULL;
+
+	hc_write_byte(&out, wide_begin);
+	hc_write_byte(&out, (hc_byte)width);
+	hc_write_u32(&out, alphabet);
+	hc_write_u64(&out, count);
+	hc_write_u32(&out, unique);
 
-	/* construct the tree */
-	hc_construct_tree(tree);
+	/*
+	 * the lengths of the symbols that occur, in order, each with the
+	 * gap since the one before: seven bits per byte of gap << 5 | length
+	 */
+	for (i = 0; i <= alphabet && !out.error; i++)
+	{
+		hc_ulong v;
 
-	/* assign bit codes to the leaves */
-	hc_assign_codes(tree);
+		if (lens[i] == 0)
+			continue;
 
-	/* populate the bit code dictionary with bit codes */
-	dict = (hc_sym*)malloc(sizeof(hc_sym) * unique);
-	for (i = 0, j = 0; i < UCHAR_MAX + 1; i++)
-	{
-		if (data[i].f > 0)
+		v = (i - prev) << 5 | lens[i];
+		prev = i + 1;
+
+		do
 		{
-			dict[j].b = data[i].b;
-			dict[j].f = data[i].f;
-			dict[j].n = data[i].n;
-			dict[j++].code = data[i].code;
-		}
+			hc_write_byte(&out, (hc_byte)((v & 0x7F) | (v > 0x7F ? 0x80 : 0)));
+			v >>= 7;
+		} while (v > 0);
 	}
 
-	/* write the bit code dictionary to the output stream */
-	hc_write_table(out_stream, dict, unique);
+	hc_write_u64(&out, bits);
+
+	bw.out = &out;
+	bw.acc = 0;
+	bw.count = 0;
 
-	if (ferror(out_stream))
+	for (n = 0; n < count && !out.error; n++)
 	{
-		hc_destroy_list(tree);
-		return 0;
-	}
+		hc_uint v = hc_get_wide(src, n, width);
+		hc_ulong s = v < alphabet ? v : alphabet;
 
-	/* encode the data from the input stream */
-	enc = hc_encode_data(in_stream, dict, unique);
+		hc_put_bits(&bw, codes[s], lens[s]);
 
-	if (ferror(in_stream))
-	{
-		hc_destroy_list(tree);
-		hc_destroy_bitstring(enc);
-		return 0;
+		/* escaped values follow their code in full */
+		if (s == alphabet)
+			hc_put_bits(&bw, v, width * CHAR_BIT);
 	}
 
-	/* write the encoded data to the output stream */
-	hc_write_data(out_stream, enc);
+	hc_flush_bits(&bw);
+	hc_write_byte(&out, data_end);
+
+	free(counts);
+	free(weights);
+	free(syms);
+	free(lens);
+	free(codes);
+
+	return out.error ? HC_BUFFER_ERROR : out.len;
+}
+
+int hc_wide_info(const void* src, size_t len, unsigned int* width,
+	hc_ullong* count)
+{
+	const hc_byte* in = (const hc_byte*)src;
+
+	if (len < 14 || in[0] != wide_begin || (in[1] != 2 && in[1] != 4))
+		return 0;
 
-	hc_destroy_list(tree);
-	hc_destroy_bitstring(enc);
+	*width = in[1];
+	*count = hc_get_u64(in + 6);
 
 	return 1;
 }
 
-int hc_decode_file(FILE *in_stream, FILE *out_stream)
+size_t hc_decode_wide(const void* src, size_t len, void* dst, size_t cap,
+	unsigned int width)
 {
-	size_t len;
-	hc_sym* dict;
-	hc_node_list* tree;
-	hc_bitstring* enc;
+	const hc_byte* in = (const hc_byte*)src;
+	hc_wide_entry* entries = NULL;
+	hc_byte* lens = NULL;
+	hc_uint* codes = NULL;
+	hc_bitreader br;
+	hc_ullong count;
+	hc_ullong bits = 0;
+	hc_ullong i;
+	hc_ulong alphabet;
+	hc_ulong unique;
+	hc_ulong sym = 0;
+	hc_ulong k;
+	unsigned int stream_width;
+	unsigned int primary = 0;
+	size_t pos = 18;
+	int ok;
 
-	/* read the bit code dictionary from the input stream */
-	dict = hc_read_table(in_stream, &len);
+	hc_init_bits(&br, in, 0);
 
-	/* reconstruct the tree from the bit code dictionary */
-	tree = hc_reconstruct_tree(dict, len);
+	ok = hc_wide_info(src, len, &stream_width, &count) && len >= pos
+		&& stream_width == width && count <= cap;
 
-	/* read the encoded data from the input stream */
-	enc = hc_read_data(in_stream);
+	if (ok)
+	{
+		alphabet = hc_get_u32(in + 2);
+		unique = hc_get_u32(in + 14);
+		ok = alphabet > 0 && alphabet <= HC_MAX_ALPHABET
+			&& unique <= alphabet + 1 && (count > 0) == (unique > 0);
+	}
 
-	if (ferror(in_stream))
+	if (ok)
 	{
-		hc_destroy_list(tree);
-		return 0;
+		lens = (hc_byte*)hc_calloc(alphabet + 1, sizeof(hc_byte));
+		codes = (hc_uint*)hc_malloc(sizeof(hc_uint) * (alphabet + 1));
 	}
 
-	/* decode the bit string and write to the output stream */
-	hc_decode_data(enc, tree, out_stream);
+	/* the lengths of the symbols that occur, see hc_encode_wide */
+	for (k = 0; ok && k < unique; k++)
+	{
+		hc_ulong v = 0;
+		unsigned int shift = 0;
+
+		do
+		{
+			ok = pos < len && shift < 28;
+			if (ok)
+				v |= (hc_ulong)(in[pos] & 0x7F) << shift;
+			shift += 7;
+		} while (ok && in[pos++] & 0x80);
+
+		sym += v >> 5;
+		ok = ok && sym <= alphabet && (v & 0x1F) > 0
+			&& (v & 0x1F) <= HC_DECODE_MAX_BITS;
+		if (ok)
+			lens[sym++] = (hc_byte)(v & 0x1F);
+	}
 
-	hc_destroy_bitstring(enc);
-	hc_destroy_list(tree);
+	ok = ok && len - pos >= 9 && hc_wide_codes(lens, alphabet + 1, codes);
 
-	if (ferror(out_stream))
-		return 0;
+	if (ok)
+	{
+		bits = hc_get_u64(in + pos);
+		pos += 8;
+		ok = bits / CHAR_BIT + (bits % CHAR_BIT > 0) < len - pos
+			&& in[pos + (bits + CHAR_BIT - 1) / CHAR_BIT] == data_end;
+	}
 
-	return 1;
+	if (ok && unique > 0)
+	{
+		entries = hc_create_wide_table(lens, codes, alphabet + 1, &primary);
+		hc_init_bits(&br, in + pos, (bits + CHAR_BIT - 1) / CHAR_BIT);
+	}
+
+	for (i = 0; ok && i < count; i++)
+	{
+		hc_wide_entry e;
+		hc_uint v;
+
+		if (br.count < HC_DECODE_MAX_BITS)
+			hc_refill_bits(&br);
+
+		e = entries[br.buf & (((hc_ulong)1 << primary) - 1)];
+		if (e.sub > 0)
+		{
+			e = entries[e.sym
+				+ ((br.buf >> primary) & (((hc_ulong)1 << e.sub) - 1))];
+		}
+
+		br.buf >>= e.len;
+		br.count -= e.len;
+		v = e.sym;
+		ok = e.len > 0;
+
+		/* escaped values follow their code in full */
+		if (ok && e.sym == alphabet)
+		{
+			if (br.count < width * CHAR_BIT)
+				hc_refill_bits(&br);
+			v = (hc_uint)(br.buf & (((hc_ullong)1 << (width * CHAR_BIT)) - 1));
+			br.buf >>= width * CHAR_BIT;
+			br.count -= width * CHAR_BIT;
+		}
+
+		if (width == 2)
+			((hc_ushort*)dst)[i] = (hc_ushort)v;
+		else
+			((hc_uint*)dst)[i] = v;
+	}
+
+	/* the codes have to use up the data exactly */
+	ok = ok && (unique == 0 ? bits == 0 : (hc_ullong)(br.in - (in + pos)
+		+ br.pad) * CHAR_BIT - br.count == bits);
+
+	free(entries);
+	free(lens);
+	free(codes);
+
+	return ok ? (size_t)count : HC_BUFFER_ERROR;
 }
@@ -5,11 +5,85 @@
 #include <limits.h>
 
 typedef unsigned char hc_byte;
+typedef unsigned short hc_ushort;
+typedef unsigned int hc_uint;
 typedef unsigned long hc_ulong;
+typedef unsigned long long hc_ullong;
 typedef struct hc_sym hc_sym;
 typedef struct hc_node hc_node;
 typedef struct hc_node_list hc_node_list;
 typedef struct hc_bitstring hc_bitstring;
+typedef struct hc_arena hc_arena;
+typedef struct hc_codebook hc_codebook;
+typedef struct hc_registry hc_registry;
+typedef struct hc_decode_entry hc_decode_entry;
+typedef struct hc_multi_entry hc_multi_entry;
+typedef struct hc_decoder hc_decoder;
+typedef struct hc_encode_entry hc_encode_entry;
+typedef struct hc_reader hc_reader;
+typedef struct hc_writer hc_writer;
+typedef struct hc_options hc_options;
+typedef struct hc_block_info hc_block_info;
+typedef struct hc_stats hc_stats;
+
+/*
+ * Number of bits the decoder peeks at once. Codes up to this length
+ * are resolved with a single table probe, longer codes go through a
+ * secondary table of up to HC_DECODE_MAX_BITS - HC_DECODE_BITS bits.
+ */
+#define HC_DECODE_BITS 11
+#define HC_DECODE_MAX_BITS 24
+
+/*
+ * Most symbols one probe of a multi-symbol table decodes, and the
+ * fewest a probe has to decode on average, in 1/256ths of a symbol,
+ * for hc_create_decoder to keep such a table. Tables of codes of 6
+ * bits or more average one symbol a probe and are left to the
+ * single-symbol lookup.
+ */
+#define HC_MULTI_SYMBOLS 4
+#define HC_MULTI_MIN_AVERAGE 384
+
+/* size of the buffers used by hc_reader and hc_writer */
+#define HC_IO_BUFFER 131072
+
+/* number of input bytes that share one table in hc_encode_file */
+#define HC_BLOCK_SIZE 262144
+#define HC_MAX_BLOCK_SIZE 4194304
+
+/* least number of bytes between the sync points of a block */
+#define HC_MIN_SYNC_INTERVAL 1024
+
+/*
+ * Nodes in a tree over all byte values, and bytes in the longest code
+ * such a tree can give, for the storage of hc_arena.
+ */
+#define HC_ARENA_NODES (2 * (UCHAR_MAX + 1) - 1)
+#define HC_CODE_BYTES ((UCHAR_MAX + CHAR_BIT) / CHAR_BIT)
+
+/* longest code length hc_limit_code_lengths can enforce */
+#define HC_MAX_CODE_LEN 32
+
+/* returned by the buffer functions when they fail */
+#define HC_BUFFER_ERROR ((size_t)-1)
+
+/*
+ * Most code tables a block can switch between by its previous byte.
+ * Previous bytes with alike next bytes are clustered onto one table
+ * to keep the headers small.
+ */
+#define HC_MAX_CONTEXTS 64
+
+/* number of interleaved bit streams per block in hc_encode_streams */
+#define HC_STREAMS 4
+
+/*
+ * Alphabet of the wide functions when none is given, and the largest
+ * they take. Values past the alphabet are coded as an escape code
+ * followed by the value in full.
+ */
+#define HC_WIDE_ALPHABET 65536
+#define HC_MAX_ALPHABET 1048576
 
 struct hc_sym {
 	hc_byte b;          /* byte       */
@@ -31,6 +105,7 @@ struct hc_node_list {
 	unsigned long count;
 	hc_node* nodes;
 	hc_node* tail;
+	hc_arena* arena; /* owner of the nodes, NULL if allocated one by one */
 };
 
 struct hc_bitstring {
@@ -38,6 +113,134 @@ struct hc_bitstring {
 	hc_ulong byte_count;
 	hc_byte* bytes;
 	hc_byte current_bits;
+	int fixed; /* bytes belongs to an arena and cannot be resized */
+};
+
+/* holds the nodes and codes of one tree in a single allocation */
+struct hc_arena {
+	hc_node nodes[HC_ARENA_NODES];
+	hc_ulong node_count;
+	hc_bitstring codes[UCHAR_MAX + 1];
+	hc_byte code_bytes[UCHAR_MAX + 1][HC_CODE_BYTES];
+	hc_ulong code_count;
+	hc_node_list list;
+};
+
+struct hc_reader {
+	FILE* stream;
+	hc_byte* buf; /* buffered input   */
+	size_t pos;   /* next unread byte */
+	size_t len;   /* bytes in buf     */
+	size_t cap;   /* size of buf      */
+	int partial;  /* fill with whatever input is ready, for live streams */
+	hc_ullong offset; /* stream bytes read before buf */
+	hc_stats* stats;  /* if set, receives the time spent reading */
+};
+
+struct hc_writer {
+	FILE* stream;
+	hc_byte* buf;      /* pending output         */
+	size_t len;        /* bytes in buf           */
+	size_t cap;        /* size of buf            */
+	hc_ullong flushed; /* bytes passed to stream */
+	int fixed;         /* buf belongs to caller  */
+	int error;         /* output did not fit     */
+	hc_stats* stats;   /* if set, receives the time spent writing */
+};
+
+struct hc_options {
+	unsigned int threads;  /* blocks coded at once (1 for no threads)  */
+	size_t block_size;     /* input bytes per block                    */
+	unsigned int streams;  /* interleaved streams per block (1 or 4)   */
+	hc_ulong max_code_len; /* longest code allowed (0 for no limit)    */
+	hc_ullong* limit_cost; /* if set, receives the bytes the code      */
+	                       /* length limit added to the output         */
+	int map;               /* map regular files into memory (0 or 1)   */
+	int adaptive;          /* code in one pass with an adaptive tree   */
+	                       /* instead of blocks (0 or 1)               */
+	int live;              /* code input as soon as it arrives and     */
+	                       /* flush the output after it (0 or 1)       */
+	hc_stats* stats;       /* if set, receives timings and counters    */
+	hc_ulong sync_interval; /* bytes between sync points for decoding  */
+	                       /* ranges (0 for none, single stream only)  */
+	unsigned int contexts; /* most tables per block picked by the    */
+	                       /* previous byte (1 for one table, up to    */
+	                       /* HC_MAX_CONTEXTS, single stream only;     */
+	                       /* such blocks get no sync points)          */
+};
+
+/*
+ * Where the time of an encode or decode call went, filled in by the
+ * _ex file and buffer functions when their options point at one.
+ * Phase times are in seconds from a monotonic clock. Blocks coded on
+ * several threads add up their times, which can then exceed the total.
+ */
+struct hc_stats {
+	double read_time;       /* reading input                          */
+	double histogram_time;  /* counting bytes                         */
+	double tree_time;       /* building and limiting codes            */
+	double table_time;      /* writing code tables, or reading them   */
+	                        /* and building decode tables             */
+	double code_time;       /* encoding or decoding data              */
+	double write_time;      /* writing output                         */
+	double total_time;      /* the whole call                         */
+	hc_ullong bytes_in;
+	hc_ullong bytes_out;
+	hc_ullong blocks;
+	hc_ullong header_bytes; /* bytes of code tables                   */
+	hc_ullong code_bits;    /* bits of coded data, excluding padding  */
+	hc_ullong symbols;      /* bytes those bits code                  */
+	hc_ulong unique;        /* most distinct bytes in one block       */
+	hc_ulong max_code_len;  /* longest code in any table              */
+	hc_ullong allocations;  /* heap allocations, including those of   */
+	                        /* other calls collecting stats meanwhile */
+};
+
+struct hc_block_info {
+	hc_ullong offset;  /* position of the block in the file */
+	hc_ulong size;     /* encoded size of the block         */
+	hc_ulong raw_size; /* decoded size of the block         */
+};
+
+struct hc_encode_entry {
+	hc_ullong code; /* bits of the code, first bit lowest */
+	hc_byte len;    /* code length (0 for absent bytes)   */
+};
+
+struct hc_decode_entry {
+	hc_ushort sym; /* symbol, or offset of a secondary table */
+	hc_byte len;   /* code length (0 for links and unused entries) */
+	hc_byte sub;   /* index width of the secondary table for links */
+};
+
+struct hc_multi_entry {
+	hc_byte syms[HC_MULTI_SYMBOLS]; /* symbols in the order decoded    */
+	hc_byte count; /* number of symbols (0 if the first code is long) */
+	hc_byte len;   /* bits of all the codes together                  */
+};
+
+struct hc_decoder {
+	hc_decode_entry* entries; /* primary table followed by secondary tables */
+	hc_ulong size;            /* total number of entries */
+	unsigned int bits;        /* index width of the primary table */
+	hc_node_list* tree;       /* fallback for codes too long for the table */
+	hc_multi_entry* multi;    /* HC_DECODE_BITS wide table of whole codes */
+	                          /* for short codes (NULL if not worth it)  */
+};
+
+struct hc_codebook {
+	hc_encode_entry codes[UCHAR_MAX + 1]; /* packed codes by byte value */
+	hc_sym table[UCHAR_MAX + 1];          /* codes in canonical order   */
+	hc_ulong len;                         /* number of items in table   */
+	hc_decoder* decoder;
+	hc_arena* arena;                      /* storage of the table codes */
+	hc_ulong id;                          /* hash of the code lengths   */
+};
+
+struct hc_registry {
+	hc_codebook** books; /* loaded codebooks sorted by id */
+	hc_ulong count;
+	hc_ulong cap;
 };
 
 /**
@@ -62,13 +265,75 @@ hc_node_list* hc_create_list();
 void hc_destroy_node(hc_node*);
 
 /**
- * Frees the resources allocated for a list of hc_nodes
+ * Frees the resources allocated for a list of hc_nodes. Lists taken
+ * from an arena are left to hc_reset_arena and hc_destroy_arena.
  *
  * Params:
  *   hc_node_list - a reference to the list to destroy
  */
 void hc_destroy_list(hc_node_list*);
 
+/**
+ * Creates an arena that holds the nodes and codes of one tree, so
+ * that building a tree takes no further allocations.
+ *
+ * Returns:
+ *   hc_arena - a new, empty arena
+ */
+hc_arena* hc_create_arena();
+
+/**
+ * Empties an arena so it can hold another tree. Nodes, lists and
+ * bit strings taken from it before must no longer be used.
+ *
+ * Params:
+ *   hc_arena - the arena to reset
+ */
+void hc_reset_arena(hc_arena*);
+
+/**
+ * Frees an arena along with everything taken from it.
+ *
+ * Params:
+ *   hc_arena - the arena to destroy
+ */
+void hc_destroy_arena(hc_arena*);
+
+/**
+ * Returns the empty list of an arena. hc_construct_tree takes the
+ * merged nodes of the tree from the same arena.
+ *
+ * Params:
+ *   hc_arena - the arena
+ *
+ * Returns:
+ *   hc_node_list - the list, empty until nodes are added to it
+ */
+hc_node_list* hc_arena_list(hc_arena*);
+
+/**
+ * Takes a leaf node from an arena.
+ *
+ * Params:
+ *   hc_arena - the arena
+ *
+ * Returns:
+ *   hc_node - a new leaf node, or NULL if the arena is full
+ */
+hc_node* hc_arena_node(hc_arena*);
+
+/**
+ * Takes an empty bit string from an arena. It holds up to
+ * HC_CODE_BYTES bytes, enough for any code of a byte tree.
+ *
+ * Params:
+ *   hc_arena - the arena
+ *
+ * Returns:
+ *   hc_bitstring - a new bit string, or NULL if the arena is full
+ */
+hc_bitstring* hc_arena_bitstring(hc_arena*);
+
 /**
  * Inserts an hc_node into an hc_node_list.
  *
@@ -79,7 +344,10 @@ void hc_destroy_list(hc_node_list*);
 void hc_add_node(hc_node_list*, hc_node*);
 
 /**
- * Sorts a list of hc_nodes by frequency.
+ * Sorts a list of hc_nodes by frequency, keeping nodes of equal
+ * frequency in list order, with a radix sort in linear time. Lists
+ * longer than a byte alphabet need scratch memory and are left
+ * unsorted if it cannot be allocated.
  *
  * Params:
  *   hc_node_list - a reference to a list of hc_nodes
@@ -87,7 +355,10 @@ void hc_add_node(hc_node_list*, hc_node*);
 void hc_sort_leaves(hc_node_list*);
 
 /**
- * Constructs a binary tree from a list of hc_nodes.
+ * Constructs a binary tree from a list of hc_nodes sorted with
+ * hc_sort_leaves, in linear time. Afterwards the list holds only
+ * the root of the tree. As with hc_sort_leaves, lists longer than a
+ * byte alphabet are left as they are if scratch memory runs out.
  *
  * Params:
  *   hc_node_list - a reference to a list of hc_nodes
@@ -95,10 +366,35 @@ void hc_sort_leaves(hc_node_list*);
 void hc_construct_tree(hc_node_list*);
 
 /**
- * Traverses a tree of hc_nodes and assigns codes;
+ * Traverses a tree of hc_nodes and assigns canonical codes
+ * based on the depth of each leaf. Trees with more leaves than a
+ * byte alphabet need scratch memory and are left without codes if
+ * it cannot be allocated.
+ *
+ * Params:
+ *   hc_node_list - a reference to a Huffman tree
  */
 void hc_assign_codes(hc_node_list*);
 
+/**
+ * Limits the codes of a bit code table to a maximum length using
+ * package-merge, which finds the best codes within the limit. The
+ * frequencies and lengths in the table must be set. Tables whose
+ * codes already fit are left as they are; otherwise the lengths and
+ * canonical codes are replaced.
+ *
+ * Params:
+ *   hc_sym - the bit code table
+ *   unsigned long - the number of items in the bit code table
+ *   unsigned long - the longest code length allowed, up to HC_MAX_CODE_LEN
+ *   unsigned long long - if not NULL, receives the number of bits
+ *                        the limit adds to the encoded data
+ *
+ * Returns:
+ *   int - 0 if no codes of that length can hold the table, otherwise 1
+ */
+int hc_limit_code_lengths(hc_sym*, hc_ulong, hc_ulong, hc_ullong*);
+
 /**
  * Prints the contents of an hc_node_list to standard output.
  *
@@ -166,60 +462,229 @@ void hc_remove_bit(hc_bitstring*);
 void hc_print_bitstring(hc_bitstring*);
 
 /**
- * Converts the contents of a file to a bit string
- * using a table of bit codes.
+ * Creates a block-buffered reader on top of a stream.
+ *
+ * Params:
+ *   FILE - the input stream
+ *
+ * Returns:
+ *   hc_reader - a new reader
+ */
+hc_reader* hc_create_reader(FILE*);
+
+/**
+ * Creates a reader over bytes in memory. The bytes are not copied
+ * and must outlive the reader.
+ *
+ * Params:
+ *   void - the bytes to read
+ *   size_t - the number of bytes
+ *
+ * Returns:
+ *   hc_reader - a new reader
+ */
+hc_reader* hc_create_memory_reader(const void*, size_t);
+
+/**
+ * Frees the resources allocated for a reader. Bytes that were
+ * buffered but not consumed are given back to seekable streams.
+ *
+ * Params:
+ *   hc_reader - the reader to destroy
+ */
+void hc_destroy_reader(hc_reader*);
+
+/**
+ * Reads a block of bytes through a reader.
+ *
+ * Params:
+ *   hc_reader - the reader
+ *   void - the destination buffer
+ *   size_t - the number of bytes to read
+ *
+ * Returns:
+ *   size_t - the number of bytes read
+ */
+size_t hc_read(hc_reader*, void*, size_t);
+
+/**
+ * Creates a block-buffered writer on top of a stream.
+ *
+ * Params:
+ *   FILE - the output stream
+ *
+ * Returns:
+ *   hc_writer - a new writer
+ */
+hc_writer* hc_create_writer(FILE*);
+
+/**
+ * Creates a writer that keeps its output in its own buffer,
+ * which grows as needed.
+ *
+ * Params:
+ *   size_t - the initial size of the buffer
+ *
+ * Returns:
+ *   hc_writer - a new writer
+ */
+hc_writer* hc_create_memory_writer(size_t);
+
+/**
+ * Creates a writer that fills a buffer owned by the caller.
+ * Output that does not fit is dropped and the writer's error
+ * flag is set.
+ *
+ * Params:
+ *   void - the destination buffer
+ *   size_t - the size of the destination buffer
+ *
+ * Returns:
+ *   hc_writer - a new writer
+ */
+hc_writer* hc_create_buffer_writer(void*, size_t);
+
+/**
+ * Flushes and frees the resources allocated for a writer.
+ *
+ * Params:
+ *   hc_writer - the writer to destroy
+ */
+void hc_destroy_writer(hc_writer*);
+
+/**
+ * Writes a block of bytes through a writer.
+ *
+ * Params:
+ *   hc_writer - the writer
+ *   void - the bytes to write
+ *   size_t - the number of bytes to write
+ */
+void hc_write(hc_writer*, const void*, size_t);
+
+/**
+ * Passes the buffered output of a writer on to its stream.
+ *
+ * Params:
+ *   hc_writer - the writer to flush
+ *
+ * Returns:
+ *   int - an integer indicating succes (0 for failure, 1 for success)
+ */
+int hc_flush_writer(hc_writer*);
+
+/**
+ * Counts how often each byte value occurs in a buffer. Neighbouring
+ * bytes are counted into separate tables that are added up at the
+ * end, so a run of one value does not wait on its own increments.
+ * The buffer is read a word at a time; vector loads would gain
+ * nothing, as the increments and not the loads bound the loop.
+ *
+ * Params:
+ *   hc_byte - the bytes to count
+ *   size_t - the number of bytes
+ *   unsigned long - the UCHAR_MAX + 1 counts to fill in
+ */
+void hc_histogram(const hc_byte*, size_t, hc_ulong*);
+
+/**
+ * Packs the codes of a bit code table into an array indexed by
+ * byte value, so that each code can be emitted with a single shift.
+ * Codes longer than 64 bits are not supported.
  *
  * Params:
- *   FILE - the input file
  *   hc_sym - the bit code table
  *   unsigned long - the number of items in the bit code table
+ *   hc_encode_entry - the UCHAR_MAX + 1 entries to fill in
+ */
+void hc_create_encode_table(hc_sym*, hc_ulong, hc_encode_entry*);
+
+/**
+ * Encodes a block of bytes using a table of bit codes and writes
+ * it to a file in the same layout as hc_write_data. The bits are
+ * written as they are produced, so no bit string is built up.
+ * The frequencies in the table must be those of the input bytes,
+ * since they are used to write the bit count ahead of the bits.
  *
- * Returns:
- *   hc_bitstring - a bit string containing the encoded data
+ * Params:
+ *   hc_writer - the output file
+ *   hc_byte - the input bytes
+ *   size_t - the number of input bytes
+ *   hc_sym - the bit code table
+ *   unsigned long - the number of items in the bit code table
+ */
+void hc_encode_data(hc_writer*, const hc_byte*, size_t, hc_sym*, hc_ulong);
+
+/**
+ * Encodes a block of bytes like hc_encode_data, but deals the codes
+ * out to HC_STREAMS separate bit streams in turn so that they can be
+ * decoded independently. The data section holds the bit count of
+ * each stream followed by the streams, each padded to a whole byte.
+ *
+ * Params:
+ *   hc_writer - the output file
+ *   hc_byte - the input bytes
+ *   size_t - the number of input bytes
+ *   hc_sym - the bit code table
+ *   unsigned long - the number of items in the bit code table
  */
-hc_bitstring* hc_encode_data(FILE*, hc_sym*, hc_ulong);
+void hc_encode_streams(hc_writer*, const hc_byte*, size_t, hc_sym*, hc_ulong);
 
 /**
  * Writes a bit code dictionary to a file
  *
  * Params:
- *   FILE - the output file
+ *   hc_writer - the output file
  *   hc_sym - the bit code dictionary
  *   unsigned long - the number of elements in the bit code dictionary
  */
-void hc_write_table(FILE*, hc_sym*, hc_ulong);
+void hc_write_table(hc_writer*, hc_sym*, hc_ulong);
 
 /**
- * Reads a bit code dictionary from a file
+ * Writes only the code lengths of a bit code dictionary to a file.
+ * The codes must be canonical, as assigned by hc_assign_codes, so
+ * that the reader can rebuild them from the lengths alone.
  *
  * Params:
- *   FILE - the input file
+ *   hc_writer - the output file
+ *   hc_sym - the bit code dictionary
+ *   unsigned long - the number of elements in the bit code dictionary
+ */
+void hc_write_lengths(hc_writer*, hc_sym*, hc_ulong);
+
+/**
+ * Reads a bit code dictionary from a file. Both full tables written
+ * by hc_write_table and length-only tables written by hc_write_lengths
+ * are accepted.
+ *
+ * Params:
+ *   hc_reader - the input file
  *   size_t - reference to the length of the returned dictionary
  *
  * Returns:
  *   hc_sym - the bit code dictionary
  */
-hc_sym* hc_read_table(FILE*, size_t*);
+hc_sym* hc_read_table(hc_reader*, size_t*);
 
 /**
  * Writes a bit string containing encoded data to a file
  *
  * Params:
- *   FILE - the output file
+ *   hc_writer - the output file
  *   hc_bitstring - the bit string to write
  */
-void hc_write_data(FILE*, hc_bitstring*);
+void hc_write_data(hc_writer*, hc_bitstring*);
 
 /**
  * Reads a bit string containing encoded data frp, a file
  *
  * Params:
- *   FILE - the output file
+ *   hc_reader - the input file
  *
  * Returns:
  *   hc_bitstring - a new bit string containing encoded data
  */
-hc_bitstring* hc_read_data(FILE*);
+hc_bitstring* hc_read_data(hc_reader*);
 
 /**
  * Reconstructs a Huffman tree from a bit code dictionary
@@ -233,18 +698,70 @@ hc_bitstring* hc_read_data(FILE*);
  */
 hc_node_list* hc_reconstruct_tree(hc_sym*, hc_ulong);
 
+/**
+ * Builds a lookup table decoder from a bit code dictionary.
+ * If the dictionary contains codes longer than HC_DECODE_MAX_BITS,
+ * the decoder falls back to walking a reconstructed Huffman tree.
+ * If the codes are short enough, it also gets a table that decodes
+ * up to HC_MULTI_SYMBOLS of them per probe.
+ *
+ * Params:
+ *   hc_sym - the bit code dictionary
+ *   hc_ulong - the number of elements in the dictionary
+ *
+ * Returns:
+ *   hc_decoder - a new decoder
+ */
+hc_decoder* hc_create_decoder(hc_sym*, hc_ulong);
+
+/**
+ * Frees the resources allocated for a decoder.
+ *
+ * Params:
+ *   hc_decoder - the decoder to destroy
+ */
+void hc_destroy_decoder(hc_decoder*);
+
 /**
  * Decodes a bit string and writes the output to a file
  *
  * Params:
  *   hc_bitstring - the data to decode
- *   hc_node_list - the Huffman tree
- *   FILE - the output stream
+ *   hc_decoder - the decoder built from the bit code dictionary
+ *   hc_writer - the output stream
+ */
+void hc_decode_data(hc_bitstring*, hc_decoder*, hc_writer*);
+
+/**
+ * Decodes the HC_STREAMS bit streams written by hc_encode_streams,
+ * taking one symbol from each stream in turn so that the lookups of
+ * different streams can overlap.
+ *
+ * Params:
+ *   hc_byte - the streams, one after another
+ *   unsigned long - the bit count of each stream
+ *   size_t - the number of symbols to decode
+ *   hc_decoder - the decoder built from the bit code dictionary
+ *   hc_writer - the output stream
+ *
+ * Returns:
+ *   int - 0 if the streams are corrupt, otherwise 1
  */
-void hc_decode_data(hc_bitstring*, hc_node_list*, FILE*);
+int hc_decode_streams(const hc_byte*, const hc_ulong*, size_t, hc_decoder*,
+	hc_writer*);
 
 /**
- * Encodes data using Huffman coding
+ * Sets encoder options to their defaults.
+ *
+ * Params:
+ *   hc_options - the options to initialize
+ */
+void hc_init_options(hc_options*);
+
+/**
+ * Encodes data using Huffman coding. The input is read once, in
+ * blocks of HC_BLOCK_SIZE bytes that each carry their own table,
+ * so it may be a pipe.
  *
  * Params:
  *   FILE - the input stream
@@ -255,6 +772,25 @@ void hc_decode_data(hc_bitstring*, hc_node_list*, FILE*);
  */
 int hc_encode_file(FILE*, FILE*);
 
+/**
+ * Encodes data using Huffman coding with the given options.
+ * With more than one thread, batches of blocks are encoded
+ * concurrently and written out in order. If the options ask for
+ * mapping and the input is a regular file, blocks are encoded
+ * straight from a read only mapping of it. In adaptive mode the input
+ * is instead coded in a single pass with a tree updated after every
+ * byte, so output follows input without waiting for a whole block.
+ *
+ * Params:
+ *   FILE - the input stream
+ *   FILE - the output stream
+ *   hc_options - the encoder options
+ *
+ * Returns:
+ *   int - an integer indicating succes (0 for failure, 1 for success)
+ */
+int hc_encode_file_ex(FILE*, FILE*, const hc_options*);
+
 /**
  * Decodes data that was encoded with Huffman coding
  *
@@ -267,4 +803,417 @@ int hc_encode_file(FILE*, FILE*);
  */
 int hc_decode_file(FILE*, FILE*);
 
+/**
+ * Decodes data that was encoded with Huffman coding with the given
+ * options. With more than one thread and a seekable input, the block
+ * index is used to decode batches of blocks concurrently. If the
+ * options ask for mapping, the input is a regular file with an index
+ * and the output a regular file open for reading and writing, the
+ * output is resized to the decoded size and every block is decoded
+ * from the mapped input into its place in the mapped output.
+ * Adaptive streams are recognized by their header and decoded in a
+ * single pass.
+ *
+ * Params:
+ *   FILE - the input stream
+ *   FILE - the output stream
+ *   hc_options - the decoder options
+ *
+ * Returns:
+ *   int - an integer indicating succes (0 for failure, 1 for success)
+ */
+int hc_decode_file_ex(FILE*, FILE*, const hc_options*);
+
+/**
+ * Decodes a range of bytes of an encoded file, reading only the blocks
+ * that hold it. Within a block, decoding starts from the closest sync
+ * point before the range if the file has them (see sync_interval in
+ * hc_options). Blocks with interleaved streams or context tables have
+ * no sync points and are decoded whole. The input must be seekable
+ * and positioned at the start of the encoded stream.
+ *
+ * Params:
+ *   FILE - the input stream
+ *   unsigned long long - the offset of the range in the decoded data
+ *   unsigned long long - the length of the range, which is cut short
+ *                        at the end of the data
+ *   FILE - the output stream
+ *
+ * Returns:
+ *   int - an integer indicating succes (0 for failure, 1 for success)
+ */
+int hc_decode_range(FILE*, hc_ullong, hc_ullong, FILE*);
+
+/**
+ * Reads the block index stored at the end of a seekable encoded
+ * stream. The position of the stream is left unchanged.
+ *
+ * Params:
+ *   FILE - the encoded stream
+ *   hc_ulong - reference to the number of blocks in the index
+ *
+ * Returns:
+ *   hc_block_info - the blocks in stream order, or NULL if the
+ *                   stream has no readable index
+ */
+hc_block_info* hc_read_index(FILE*, hc_ulong*);
+
+/**
+ * Encodes a buffer using Huffman coding into another buffer, in the
+ * same format as hc_encode_file. No streams are used.
+ *
+ * Params:
+ *   void - the input bytes
+ *   size_t - the number of input bytes
+ *   void - the output buffer
+ *   size_t - the size of the output buffer
+ *
+ * Returns:
+ *   size_t - the number of bytes written, or HC_BUFFER_ERROR if they
+ *            did not fit; hc_compress_bound gives a size that does
+ */
+size_t hc_encode_buffer(const void*, size_t, void*, size_t);
+
+/**
+ * Encodes a buffer like hc_encode_buffer with the given options.
+ * The map option has no effect.
+ *
+ * Params:
+ *   void - the input bytes
+ *   size_t - the number of input bytes
+ *   void - the output buffer
+ *   size_t - the size of the output buffer
+ *   hc_options - the encoder options
+ *
+ * Returns:
+ *   size_t - the number of bytes written, or HC_BUFFER_ERROR
+ */
+size_t hc_encode_buffer_ex(const void*, size_t, void*, size_t,
+	const hc_options*);
+
+/**
+ * Decodes a buffer encoded with Huffman coding into another buffer.
+ * No streams are used.
+ *
+ * Params:
+ *   void - the encoded bytes
+ *   size_t - the number of encoded bytes
+ *   void - the output buffer
+ *   size_t - the size of the output buffer
+ *
+ * Returns:
+ *   size_t - the number of bytes written, or HC_BUFFER_ERROR if the
+ *            input is corrupt or the output did not fit
+ */
+size_t hc_decode_buffer(const void*, size_t, void*, size_t);
+
+/**
+ * Decodes a buffer like hc_decode_buffer with the given options.
+ * With more than one thread, the block index is used to decode the
+ * blocks concurrently, each straight into its place in the output.
+ *
+ * Params:
+ *   void - the encoded bytes
+ *   size_t - the number of encoded bytes
+ *   void - the output buffer
+ *   size_t - the size of the output buffer
+ *   hc_options - the decoder options
+ *
+ * Returns:
+ *   size_t - the number of bytes written, or HC_BUFFER_ERROR
+ */
+size_t hc_decode_buffer_ex(const void*, size_t, void*, size_t,
+	const hc_options*);
+
+/**
+ * Gives the largest size hc_encode_buffer can produce for an input
+ * of the given size with the default block size.
+ *
+ * Params:
+ *   size_t - the number of input bytes
+ *
+ * Returns:
+ *   size_t - the size of an output buffer that always suffices
+ */
+size_t hc_compress_bound(size_t);
+
+/**
+ * Builds a codebook from a histogram, for coding many messages with
+ * the same table. Bytes that do not occur in the histogram are given
+ * a count of 1 so that any message can be coded. A codebook is only
+ * read once built, so one can be shared between threads.
+ *
+ * Params:
+ *   unsigned long - the UCHAR_MAX + 1 byte counts, or NULL for equal counts
+ *   unsigned long - the longest code allowed, at most HC_DECODE_MAX_BITS
+ *                   (0 for HC_DECODE_MAX_BITS)
+ *
+ * Returns:
+ *   hc_codebook - a new codebook
+ */
+hc_codebook* hc_create_codebook(const hc_ulong*, hc_ulong);
+
+/**
+ * Reads a codebook saved with hc_write_codebook.
+ *
+ * Params:
+ *   FILE - the input stream
+ *
+ * Returns:
+ *   hc_codebook - a new codebook, or NULL if the input is not one
+ */
+hc_codebook* hc_read_codebook(FILE*);
+
+/**
+ * Saves the ID and code lengths of a codebook to a file, which can be
+ * used as a dictionary.
+ *
+ * Params:
+ *   FILE - the output stream
+ *   hc_codebook - the codebook to save
+ *
+ * Returns:
+ *   int - an integer indicating succes (0 for failure, 1 for success)
+ */
+int hc_write_codebook(FILE*, const hc_codebook*);
+
+/**
+ * Frees the resources allocated for a codebook.
+ *
+ * Params:
+ *   hc_codebook - the codebook to destroy
+ */
+void hc_destroy_codebook(hc_codebook*);
+
+/**
+ * Gives the largest size hc_codebook_encode can produce for a message.
+ *
+ * Params:
+ *   hc_codebook - the codebook
+ *   size_t - the number of bytes in the message
+ *
+ * Returns:
+ *   size_t - the size of an output buffer that always suffices
+ */
+size_t hc_codebook_bound(const hc_codebook*, size_t);
+
+/**
+ * Encodes a message with a codebook. The output holds only the
+ * message length and the codes, without a table.
+ *
+ * Params:
+ *   hc_codebook - the codebook
+ *   void - the message
+ *   size_t - the number of bytes in the message
+ *   void - the output buffer
+ *   size_t - the size of the output buffer
+ *
+ * Returns:
+ *   size_t - the number of bytes written, or HC_BUFFER_ERROR if they
+ *            did not fit
+ */
+size_t hc_codebook_encode(const hc_codebook*, const void*, size_t, void*,
+	size_t);
+
+/**
+ * Decodes a message encoded with hc_codebook_encode, using the same
+ * codebook.
+ *
+ * Params:
+ *   hc_codebook - the codebook
+ *   void - the encoded message
+ *   size_t - the number of encoded bytes
+ *   void - the output buffer
+ *   size_t - the size of the output buffer
+ *
+ * Returns:
+ *   size_t - the number of bytes written, or HC_BUFFER_ERROR if the
+ *            input is corrupt or the output did not fit
+ */
+size_t hc_codebook_decode(const hc_codebook*, const void*, size_t, void*,
+	size_t);
+
+/**
+ * Adds the byte counts of the rest of a stream to a histogram, for
+ * training a dictionary over many sample files.
+ *
+ * Params:
+ *   FILE - the input stream
+ *   unsigned long - the UCHAR_MAX + 1 byte counts to add to
+ *
+ * Returns:
+ *   int - an integer indicating succes (0 for failure, 1 for success)
+ */
+int hc_count_file(FILE*, hc_ulong*);
+
+/**
+ * Gives the largest size hc_dict_encode can produce for a message.
+ *
+ * Params:
+ *   hc_codebook - the dictionary
+ *   size_t - the number of bytes in the message
+ *
+ * Returns:
+ *   size_t - the size of an output buffer that always suffices
+ */
+size_t hc_dict_bound(const hc_codebook*, size_t);
+
+/**
+ * Encodes a message with a dictionary. Like hc_codebook_encode, but
+ * the output starts with the dictionary ID so that a decoder can pick
+ * the dictionary from a registry.
+ *
+ * Params:
+ *   hc_codebook - the dictionary
+ *   void - the message
+ *   size_t - the number of bytes in the message
+ *   void - the output buffer
+ *   size_t - the size of the output buffer
+ *
+ * Returns:
+ *   size_t - the number of bytes written, or HC_BUFFER_ERROR if they
+ *            did not fit
+ */
+size_t hc_dict_encode(const hc_codebook*, const void*, size_t, void*, size_t);
+
+/**
+ * Reads the dictionary ID and decoded size of a message encoded with
+ * hc_dict_encode.
+ *
+ * Params:
+ *   void - the encoded message
+ *   size_t - the number of encoded bytes
+ *   unsigned long - receives the dictionary ID
+ *   unsigned long long - receives the decoded size
+ *
+ * Returns:
+ *   int - an integer indicating succes (0 for failure, 1 for success)
+ */
+int hc_dict_info(const void*, size_t, hc_ulong*, hc_ullong*);
+
+/**
+ * Decodes a message encoded with hc_dict_encode, looking up its
+ * dictionary in a registry.
+ *
+ * Params:
+ *   hc_registry - the loaded dictionaries
+ *   void - the encoded message
+ *   size_t - the number of encoded bytes
+ *   void - the output buffer
+ *   size_t - the size of the output buffer
+ *
+ * Returns:
+ *   size_t - the number of bytes written, or HC_BUFFER_ERROR if the
+ *            dictionary is not loaded, the input is corrupt or the
+ *            output did not fit
+ */
+size_t hc_dict_decode(const hc_registry*, const void*, size_t, void*, size_t);
+
+/**
+ * Creates an empty registry of dictionaries.
+ *
+ * Returns:
+ *   hc_registry - a new, empty registry
+ */
+hc_registry* hc_create_registry();
+
+/**
+ * Frees a registry along with the codebooks registered in it.
+ *
+ * Params:
+ *   hc_registry - the registry to destroy
+ */
+void hc_destroy_registry(hc_registry*);
+
+/**
+ * Adds a codebook to a registry, which takes ownership of it.
+ *
+ * Params:
+ *   hc_registry - the registry
+ *   hc_codebook - the codebook to add
+ *
+ * Returns:
+ *   int - 0 if a codebook with the same ID is already registered
+ *         (the codebook is then left to the caller), 1 otherwise
+ */
+int hc_register_codebook(hc_registry*, hc_codebook*);
+
+/**
+ * Looks up a codebook by ID.
+ *
+ * Params:
+ *   hc_registry - the registry
+ *   unsigned long - the dictionary ID
+ *
+ * Returns:
+ *   hc_codebook - the codebook, or NULL if none has the ID
+ */
+hc_codebook* hc_find_codebook(const hc_registry*, hc_ulong);
+
+/**
+ * Gives the largest size hc_encode_wide can produce.
+ *
+ * Params:
+ *   size_t - the number of symbols
+ *   unsigned int - the bytes per symbol (2 or 4)
+ *   unsigned long - the alphabet (0 for HC_WIDE_ALPHABET)
+ *
+ * Returns:
+ *   size_t - the size of an output buffer that always suffices, or
+ *            HC_BUFFER_ERROR for a bad width or alphabet
+ */
+size_t hc_wide_bound(size_t, unsigned int, hc_ulong);
+
+/**
+ * Encodes an array of 16 or 32 bit symbols, such as token or
+ * dictionary IDs, with one table for the whole array. Values below
+ * the alphabet get codes of their own; larger values, which only 32
+ * bit symbols can have, share an escape code and follow it in full.
+ *
+ * Params:
+ *   void - the symbols, unsigned short or unsigned int by width
+ *   size_t - the number of symbols
+ *   unsigned int - the bytes per symbol (2 or 4)
+ *   unsigned long - the alphabet, at most HC_MAX_ALPHABET
+ *                   (0 for HC_WIDE_ALPHABET)
+ *   void - the output buffer
+ *   size_t - the size of the output buffer
+ *
+ * Returns:
+ *   size_t - the number of bytes written, or HC_BUFFER_ERROR if they
+ *            did not fit or the width or alphabet is bad
+ */
+size_t hc_encode_wide(const void*, size_t, unsigned int, hc_ulong, void*,
+	size_t);
+
+/**
+ * Reads the symbol width and count of an hc_encode_wide output.
+ *
+ * Params:
+ *   void - the encoded bytes
+ *   size_t - the number of encoded bytes
+ *   unsigned int - receives the bytes per symbol
+ *   unsigned long long - receives the number of symbols
+ *
+ * Returns:
+ *   int - an integer indicating succes (0 for failure, 1 for success)
+ */
+int hc_wide_info(const void*, size_t, unsigned int*, hc_ullong*);
+
+/**
+ * Decodes an array of symbols encoded with hc_encode_wide.
+ *
+ * Params:
+ *   void - the encoded bytes
+ *   size_t - the number of encoded bytes
+ *   void - the output array
+ *   size_t - the number of symbols the output array holds
+ *   unsigned int - the bytes per symbol, as encoded (2 or 4)
+ *
+ * Returns:
+ *   size_t - the number of symbols decoded, or HC_BUFFER_ERROR if the
+ *            input is corrupt or the output did not fit
+ */
+size_t hc_decode_wide(const void*, size_t, void*, size_t, unsigned int);
+
 #endif
@@ -1,48 +1,489 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
 
 #include "huffman.h"
 
+static void usage(void)
+{
+	fprintf(stderr, "usage: hcode -e [-T threads] [-S] [-L bits] [-C tables] [--sync KB] <input> <output>\n");
+	fprintf(stderr, "       hcode -e -A <input> <output>\n");
+	fprintf(stderr, "       hcode -d [-T threads] <input> <output>\n");
+	fprintf(stderr, "       hcode -d --range start:end <input> <output>\n");
+	fprintf(stderr, "       hcode -e|-d -D <dictionary> <input> <output>\n");
+	fprintf(stderr, "       hcode -e|-d -W 16|32 <input> <output>\n");
+	fprintf(stderr, "       hcode --train [-L bits] <samples...> -o <dictionary>\n");
+	fprintf(stderr, "use - for standard input or output, "
+		"--stats[=json] to report timings without --range, -D or -W\n");
+	fprintf(stderr, "--range decodes blocks coded with -S or -C whole, "
+		"as they have no sync points\n");
+}
+
+static void print_stats(const hc_stats* stats, int json)
+{
+	double ratio = stats->bytes_in > 0
+		? (double)stats->bytes_out / stats->bytes_in : 0;
+	double average = stats->symbols > 0
+		? (double)stats->code_bits / stats->symbols : 0;
+
+	if (json)
+	{
+		fprintf(stderr, "{\"read_time\": %.6f, \"histogram_time\": %.6f, "
+			"\"tree_time\": %.6f, \"table_time\": %.6f, "
+			"\"code_time\": %.6f, \"write_time\": %.6f, "
+			"\"total_time\": %.6f, \"bytes_in\": %llu, "
+			"\"bytes_out\": %llu, \"blocks\": %llu, "
+			"\"header_bytes\": %llu, \"unique\": %lu, "
+			"\"max_code_len\": %lu, \"avg_code_len\": %.4f, "
+			"\"allocations\": %llu}\n",
+			stats->read_time, stats->histogram_time, stats->tree_time,
+			stats->table_time, stats->code_time, stats->write_time,
+			stats->total_time, stats->bytes_in, stats->bytes_out,
+			stats->blocks, stats->header_bytes, stats->unique,
+			stats->max_code_len, average, stats->allocations);
+		return;
+	}
+
+	fprintf(stderr, "read        %10.6f s\n", stats->read_time);
+	fprintf(stderr, "histogram   %10.6f s\n", stats->histogram_time);
+	fprintf(stderr, "tree        %10.6f s\n", stats->tree_time);
+	fprintf(stderr, "tables      %10.6f s\n", stats->table_time);
+	fprintf(stderr, "code        %10.6f s\n", stats->code_time);
+	fprintf(stderr, "write       %10.6f s\n", stats->write_time);
+	fprintf(stderr, "total       %10.6f s\n", stats->total_time);
+	fprintf(stderr, "bytes       %llu in, %llu out (%.4f)\n",
+		stats->bytes_in, stats->bytes_out, ratio);
+	fprintf(stderr, "blocks      %llu, %llu header bytes\n",
+		stats->blocks, stats->header_bytes);
+	fprintf(stderr, "codes       %lu symbols, longest %lu bits, "
+		"average %.4f bits\n", stats->unique, stats->max_code_len, average);
+	fprintf(stderr, "allocations %llu\n", stats->allocations);
+}
+
+/* builds a dictionary from the byte counts of all sample files */
+static int train(int argc, char** argv)
+{
+	hc_ulong counts[UCHAR_MAX + 1] = { 0 };
+	hc_ulong max_code_len = 0;
+	const char* out_path = NULL;
+	hc_codebook* book;
+	FILE* stream;
+	int samples = 0;
+	int ok = 1;
+	int i;
+
+	for (i = 2; i < argc && ok; i++)
+	{
+		if (!strcmp(argv[i], "-o") && i + 1 < argc)
+		{
+			out_path = argv[++i];
+		}
+		else if (!strcmp(argv[i], "-L") && i + 1 < argc)
+		{
+			max_code_len = strtoul(argv[++i], NULL, 10);
+		}
+		else
+		{
+			stream = fopen(argv[i], "rb");
+			if (stream == NULL)
+			{
+				fprintf(stderr, "could not open sample %s\n", argv[i]);
+				return 1;
+			}
+			ok = hc_count_file(stream, counts);
+			fclose(stream);
+			samples++;
+		}
+	}
+
+	if (out_path == NULL || samples == 0)
+	{
+		usage();
+		return 1;
+	}
+
+	stream = fopen(out_path, "wb");
+	if (stream == NULL)
+	{
+		fprintf(stderr, "could not open output file\n");
+		return 1;
+	}
+
+	/* symbols missing from the samples get the smallest count */
+	book = hc_create_codebook(counts, max_code_len);
+	ok = ok && hc_write_codebook(stream, book);
+	if (fclose(stream) != 0)
+		ok = 0;
+
+	if (!ok)
+	{
+		fprintf(stderr, "training failed\n");
+		hc_destroy_codebook(book);
+		return 1;
+	}
+
+	fprintf(stderr, "dictionary %08lx from %d samples\n", book->id, samples);
+	hc_destroy_codebook(book);
+
+	return 0;
+}
+
+/* reads the rest of a stream into a new buffer */
+static hc_byte* read_all(FILE* stream, size_t* size)
+{
+	size_t cap = HC_IO_BUFFER;
+	hc_byte* buf = (hc_byte*)malloc(cap);
+	size_t n;
+
+	*size = 0;
+	while ((n = fread(buf + *size, 1, cap - *size, stream)) > 0)
+	{
+		*size += n;
+		if (*size == cap)
+		{
+			cap *= 2;
+			buf = (hc_byte*)realloc(buf, cap);
+		}
+	}
+
+	if (ferror(stream))
+	{
+		free(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
+/* codes a whole stream as one message tagged with a dictionary ID */
+static int code_dict(const char* mode, const char* dict_path, FILE* in_stream,
+	FILE* out_stream)
+{
+	hc_registry* registry;
+	hc_codebook* book;
+	hc_byte* in;
+	hc_byte* out = NULL;
+	size_t in_size;
+	size_t out_size = HC_BUFFER_ERROR;
+	hc_ulong id;
+	hc_ullong size;
+	FILE* stream;
+
+	stream = fopen(dict_path, "rb");
+	if (stream == NULL)
+		return 0;
+	book = hc_read_codebook(stream);
+	fclose(stream);
+	if (book == NULL)
+	{
+		fprintf(stderr, "%s is not a dictionary\n", dict_path);
+		return 0;
+	}
+
+	registry = hc_create_registry();
+	hc_register_codebook(registry, book);
+
+	in = read_all(in_stream, &in_size);
+	if (in == NULL)
+	{
+		hc_destroy_registry(registry);
+		return 0;
+	}
+
+	if (!strcmp(mode, "-e"))
+	{
+		size = hc_dict_bound(book, in_size);
+		out = (hc_byte*)malloc(size);
+		out_size = hc_dict_encode(book, in, in_size, out, size);
+	}
+	else if (hc_dict_info(in, in_size, &id, &size) && size == (size_t)size)
+	{
+		if (hc_find_codebook(registry, id) == NULL)
+			fprintf(stderr, "dictionary %08lx is not loaded\n", id);
+		out = (hc_byte*)malloc(size > 0 ? (size_t)size : 1);
+		out_size = hc_dict_decode(registry, in, in_size, out, (size_t)size);
+	}
+
+	if (out_size != HC_BUFFER_ERROR
+		&& fwrite(out, 1, out_size, out_stream) != out_size)
+	{
+		out_size = HC_BUFFER_ERROR;
+	}
+
+	free(in);
+	free(out);
+	hc_destroy_registry(registry);
+
+	return out_size != HC_BUFFER_ERROR;
+}
+
+/* codes a whole stream of 16 or 32 bit symbols with one table */
+static int code_wide(const char* mode, unsigned int width, FILE* in_stream,
+	FILE* out_stream)
+{
+	hc_byte* in;
+	hc_byte* out = NULL;
+	size_t in_size;
+	size_t out_size = HC_BUFFER_ERROR;
+	hc_ullong count;
+	size_t cap;
+
+	in = read_all(in_stream, &in_size);
+	if (in == NULL)
+		return 0;
+
+	if (!strcmp(mode, "-e") && in_size % width == 0)
+	{
+		cap = hc_wide_bound(in_size / width, width, 0);
+		out = (hc_byte*)malloc(cap);
+		out_size = hc_encode_wide(in, in_size / width, width, 0, out, cap);
+	}
+	else if (!strcmp(mode, "-d") && hc_wide_info(in, in_size, &width, &count)
+		&& count <= (size_t)-1 / width)
+	{
+		/* the symbols are as wide as they were encoded */
+		out = (hc_byte*)malloc(count > 0 ? (size_t)count * width : 1);
+		out_size = hc_decode_wide(in, in_size, out, (size_t)count, width);
+		if (out_size != HC_BUFFER_ERROR)
+			out_size *= width;
+	}
+
+	if (out_size != HC_BUFFER_ERROR
+		&& fwrite(out, 1, out_size, out_stream) != out_size)
+	{
+		out_size = HC_BUFFER_ERROR;
+	}
+
+	free(in);
+	free(out);
+
+	return out_size != HC_BUFFER_ERROR;
+}
+
 int main(int argc, char** argv)
 {
 	FILE* in_stream;
 	FILE* out_stream;
+	const char* mode = NULL;
+	const char* in_path = NULL;
+	const char* out_path = NULL;
+	const char* dict_path = NULL;
+	unsigned int width = 0;
+	hc_options opts;
+	hc_ullong limit_cost = 0;
+	hc_stats stats;
+	int stats_json = 0;
+	const char* range = NULL;
+	hc_ullong range_start = 0;
+	hc_ullong range_len = 0;
+	int ok = 0;
+	int i;
+
+	if (argc > 1 && !strcmp(argv[1], "--train"))
+		return train(argc, argv);
+
+	hc_init_options(&opts);
+
+	for (i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-e") || !strcmp(argv[i], "-d"))
+		{
+			mode = argv[i];
+		}
+		else if (!strcmp(argv[i], "-T") && i + 1 < argc)
+		{
+			opts.threads = (unsigned int)strtoul(argv[++i], NULL, 10);
+		}
+		else if (!strcmp(argv[i], "-S"))
+		{
+			opts.streams = HC_STREAMS;
+		}
+		else if (!strcmp(argv[i], "-L") && i + 1 < argc)
+		{
+			opts.max_code_len = strtoul(argv[++i], NULL, 10);
+			opts.limit_cost = &limit_cost;
+		}
+		else if (!strcmp(argv[i], "--stats")
+			|| !strcmp(argv[i], "--stats=json"))
+		{
+			opts.stats = &stats;
+			stats_json = argv[i][7] == '=';
+		}
+		else if (!strcmp(argv[i], "-C") && i + 1 < argc)
+		{
+			opts.contexts = (unsigned int)strtoul(argv[++i], NULL, 10);
+		}
+		else if (!strcmp(argv[i], "--sync") && i + 1 < argc)
+		{
+			opts.sync_interval = strtoul(argv[++i], NULL, 10) * 1024;
+		}
+		else if (!strcmp(argv[i], "--range") && i + 1 < argc)
+		{
+			range = argv[++i];
+		}
+		else if (!strcmp(argv[i], "-A"))
+		{
+			opts.adaptive = 1;
+		}
+		else if (!strcmp(argv[i], "-W") && i + 1 < argc)
+		{
+			/* symbols are 16 or 32 bits, anything else is a mistake */
+			i++;
+			if (!strcmp(argv[i], "16"))
+				width = 2;
+			else if (!strcmp(argv[i], "32"))
+				width = 4;
+			else
+			{
+				mode = NULL;
+				break;
+			}
+		}
+		else if (!strcmp(argv[i], "-D") && i + 1 < argc)
+		{
+			dict_path = argv[++i];
+		}
+		else if (in_path == NULL)
+		{
+			in_path = argv[i];
+		}
+		else if (out_path == NULL)
+		{
+			out_path = argv[i];
+		}
+		else
+		{
+			mode = NULL;
+			break;
+		}
+	}
 
-	if (argc != 4)
+	/*
+	 * ranges are only ever decoded, and only whole files coded with
+	 * the options have stats to report
+	 */
+	if (mode == NULL || out_path == NULL
+		|| (range != NULL && strcmp(mode, "-d"))
+		|| (opts.stats != NULL
+			&& (range != NULL || dict_path != NULL || width > 0)))
 	{
-		printf("invalid number of arguments expected 4 found %d\n", argc);
+		usage();
 		return 1;
 	}
 
-	in_stream = fopen(argv[2], "rb");
+	/*
+	 * a range runs from start up to but not including end, if given;
+	 * both are plain decimals, as strtoull would take a sign and wrap
+	 */
+	if (range != NULL)
+	{
+		char* end;
+		int ok;
+
+		range_start = strtoull(range, &end, 10);
+		range_len = ~(hc_ullong)0;
+		ok = isdigit((unsigned char)range[0]) && *end == ':';
+
+		if (ok && end[1] != '\0')
+		{
+			const char* stop_text = end + 1;
+			hc_ullong stop = strtoull(stop_text, &end, 10);
+
+			ok = isdigit((unsigned char)stop_text[0]) && *end == '\0'
+				&& stop > range_start;
+			range_len = stop - range_start;
+		}
+
+		if (!ok)
+		{
+			usage();
+			return 1;
+		}
+	}
+
+#ifdef _WIN32
+	_setmode(_fileno(stdin), _O_BINARY);
+	_setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+	/* "-" reads from standard input or writes to standard output */
+	if (!strcmp(in_path, "-"))
+		in_stream = stdin;
+	else
+		in_stream = fopen(in_path, "rb");
 
 	if (in_stream == NULL)
 	{
-		printf("could not open input file\n");
+		fprintf(stderr, "could not open input file\n");
 		return 1;
 	}
 
-	out_stream = fopen(argv[3], "wb");
+	/* output files are opened for reading too so they can be mapped */
+	if (!strcmp(out_path, "-"))
+		out_stream = stdout;
+	else
+		out_stream = fopen(out_path, "w+b");
 
 	if (out_stream == NULL)
 	{
-		printf("could not open output file\n");
-		fclose(in_stream);
+		fprintf(stderr, "could not open output file\n");
+		if (in_stream != stdin)
+			fclose(in_stream);
 		return 1;
 	}
 
-	if (!strcmp(argv[1], "-e"))
+	/* regular files are mapped into memory rather than streamed */
+	opts.map = in_stream != stdin && out_stream != stdout;
+
+	/* standard input may be a live feed, passed on as it arrives */
+	opts.live = in_stream == stdin;
+
+	if (range != NULL)
+	{
+		ok = hc_decode_range(in_stream, range_start, range_len, out_stream);
+	}
+	else if (dict_path != NULL)
 	{
-		hc_encode_file(in_stream, out_stream);
+		ok = code_dict(mode, dict_path, in_stream, out_stream);
 	}
-	else if (!strcmp(argv[1], "-d"))
+	else if (width > 0)
 	{
-		hc_decode_file(in_stream, out_stream);
+		ok = code_wide(mode, width, in_stream, out_stream);
+	}
+	else if (!strcmp(mode, "-e"))
+	{
+		ok = hc_encode_file_ex(in_stream, out_stream, &opts);
+	}
+	else
+	{
+		ok = hc_decode_file_ex(in_stream, out_stream, &opts);
 	}
 
-	fclose(in_stream);
-	fclose(out_stream);
+	if (in_stream != stdin)
+		fclose(in_stream);
+	if (out_stream != stdout && fclose(out_stream) != 0)
+		ok = 0;
+
+	if (!ok)
+	{
+		fprintf(stderr, "%s failed\n", mode);
+		return 1;
+	}
+
+	if (opts.stats != NULL)
+		print_stats(&stats, stats_json);
+
+	if (opts.limit_cost != NULL && limit_cost > 0)
+	{
+		fprintf(stderr, "code length limit added %llu bytes\n",
+			limit_cost);
+	}
 
 	return 0;
 }